@@ -34,13 +34,16 @@
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #endif
 
-static char usage[] = "usage: client [-q] [-f <filename>] server:port\n";
+static char usage[] = "usage: client [-q] [-j] [-c reno|cubic|bbr|ledbat] "
+                      "[-a delayed|adaptive|immediate] [-f <filename>] "
+                      "server:port\n";
 static char *filename;
 static int quiet_opt = 0;
 
 static int parse_address(char *address, struct sockaddr_in *sin);
 static int get_nvt_line(int sd, char *line);
 static void loop_until_end(int sd);
+static int parse_ack_mode(const char *name);
 
 
 /**********************************************************************/
@@ -51,22 +54,36 @@ main(int argc, char *argv[])
     char opt;
     char *pline;
     int errflg = 0;
+    int congestion = -1;
+    int ack_mode = -1;
+    int jumbo = 0;
     int sd;
 
 
 
     filename = NULL;
     /* Parse command line options */
-    while ((opt = getopt(argc, argv, "f:q")) != EOF)
+    while ((opt = getopt(argc, argv, "f:qjc:a:")) != EOF)
     {
         switch (opt)
         {
+        case 'c':
+            if ((congestion = mycongestion(optarg)) < 0)
+                ++errflg;
+            break;
+        case 'a':
+            if ((ack_mode = parse_ack_mode(optarg)) < 0)
+                ++errflg;
+            break;
         case 'f':
             filename = optarg;
             break;
         case 'q':
             ++quiet_opt;
             break;
+        case 'j':
+            jumbo = 1;
+            break;
         case '?':
             ++errflg;
             break;
@@ -99,6 +116,29 @@ main(int argc, char *argv[])
         exit(1);
     }
 
+    if (congestion >= 0 &&
+        mysetsockopt(sd, MYSOCK_OPT_CONGESTION,
+                     &congestion, sizeof(congestion)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(1);
+    }
+
+    if (ack_mode >= 0 &&
+        mysetsockopt(sd, MYSOCK_OPT_ACK_MODE,
+                     &ack_mode, sizeof(ack_mode)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(1);
+    }
+
+    if (jumbo &&
+        mysetsockopt(sd, MYSOCK_OPT_JUMBO, &jumbo, sizeof(jumbo)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(1);
+    }
+
     sd = myconnect(sd, (struct sockaddr *) &sin, sizeof(struct sockaddr_in));
     if (sd < 0)
     {
@@ -371,3 +411,22 @@ get_nvt_line(int sd, char *line)
         last_char = this_char;
     }
 }
+
+/**********************************************************************/
+/* parse_ack_mode
+ *
+ * Maps an acknowledgement policy name to its MYSOCK_ACK_* value.
+ *
+ * Returns the value, or -1 if the name is not recognised.
+ */
+static int
+parse_ack_mode(const char *name)
+{
+    if (!strcmp(name, "delayed"))
+        return MYSOCK_ACK_DELAYED;
+    if (!strcmp(name, "adaptive"))
+        return MYSOCK_ACK_ADAPTIVE;
+    if (!strcmp(name, "immediate"))
+        return MYSOCK_ACK_IMMEDIATE;
+    return -1;
+}
@@ -0,0 +1,683 @@
+/* congestion.c--congestion control algorithms for the transport layer.
+ *
+ * each algorithm is a congestion_ops_t table; transport.c picks one per
+ * connection, according to the MYSOCK_CC_* value the application set with
+ * mysetsockopt(), and calls through it as ACKs, losses and timeouts occur.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "mysock.h"
+#include "congestion.h"
+
+
+#define INITIAL_WINDOW(cc)  (4 * (cc)->mss)    /* RFC 5681 for small MSS */
+#define MIN_SSTHRESH(cc)    (2 * (cc)->mss)
+#define SSTHRESH_INITIAL    0x7fffffff
+
+/* RFC 3465 appropriate byte counting: slow start credits up to two segments
+ * per ACK, so a receiver that delays its ACKs doesn't halve our growth
+ */
+#define ABC_LIMIT(cc)       (2 * (cc)->mss)
+
+/* CUBIC constants (RFC 8312) */
+#define CUBIC_C     0.4
+#define CUBIC_BETA  0.7
+
+/* BBR constants (draft-cardwell-iccrg-bbr-congestion-control) */
+#define BBR_HIGH_GAIN        2.885     /* 2/ln(2): doubles rate each round */
+#define BBR_CWND_GAIN        2.0
+#define BBR_MIN_RTT_WINDOW   10000000  /* usec */
+#define BBR_PROBE_RTT_TIME   200000    /* usec */
+#define BBR_FULL_BW_GROWTH   1.25
+#define BBR_FULL_BW_ROUNDS   3
+#define BBR_MIN_WINDOW(cc)   (4 * (cc)->mss)
+#define BBR_CYCLE_LEN        8
+
+enum { BBR_STARTUP, BBR_DRAIN, BBR_PROBE_BW, BBR_PROBE_RTT };
+
+/* LEDBAT constants (RFC 6817) */
+#define LEDBAT_TARGET        100000    /* usec of queueing delay */
+#define LEDBAT_GAIN          1.0
+#define LEDBAT_BASE_INTERVAL 60000000  /* usec per base history slot */
+#define LEDBAT_MIN_WINDOW(cc) (2 * (cc)->mss)
+
+static const double bbr_cycle_gains[BBR_CYCLE_LEN] =
+{
+    1.25, 0.75, 1, 1, 1, 1, 1, 1
+};
+
+
+/* shared by the loss-based algorithms */
+static void slow_start_init(congestion_t *cc);
+static bool_t window_limited(const congestion_t *cc,
+                             const congestion_ack_t *ack);
+static uint64_t window_pacing_rate(const congestion_t *cc, uint32_t srtt);
+static void window_undo(congestion_t *cc, const congestion_t *prior);
+
+static void reno_on_ack(congestion_t *cc, const congestion_ack_t *ack);
+static void reno_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void reno_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight);
+
+static void cubic_init(congestion_t *cc);
+static void cubic_on_ack(congestion_t *cc, const congestion_ack_t *ack);
+static void cubic_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void cubic_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void cubic_undo(congestion_t *cc, const congestion_t *prior);
+
+static void bbr_init(congestion_t *cc);
+static void bbr_on_ack(congestion_t *cc, const congestion_ack_t *ack);
+static void bbr_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void bbr_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static uint64_t bbr_pacing_rate(const congestion_t *cc, uint32_t srtt);
+static uint32_t bbr_bdp(const congestion_t *cc, double gain);
+static void bbr_update_model(congestion_t *cc, const congestion_ack_t *ack);
+static void bbr_update_mode(congestion_t *cc, const congestion_ack_t *ack);
+
+static void ledbat_init(congestion_t *cc);
+static void ledbat_on_ack(congestion_t *cc, const congestion_ack_t *ack);
+static void ledbat_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void ledbat_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight);
+static void ledbat_undo(congestion_t *cc, const congestion_t *prior);
+static uint32_t ledbat_queueing_delay(congestion_t *cc, uint64_t now,
+                                      uint32_t delay);
+
+
+static const congestion_ops_t reno_ops =
+{
+    "reno",
+    slow_start_init,
+    reno_on_ack,
+    reno_on_loss,
+    reno_on_rto,
+    window_undo,
+    window_pacing_rate
+};
+
+static const congestion_ops_t cubic_ops =
+{
+    "cubic",
+    cubic_init,
+    cubic_on_ack,
+    cubic_on_loss,
+    cubic_on_rto,
+    cubic_undo,
+    window_pacing_rate
+};
+
+static const congestion_ops_t bbr_ops =
+{
+    "bbr",
+    bbr_init,
+    bbr_on_ack,
+    bbr_on_loss,
+    bbr_on_rto,
+    window_undo,
+    bbr_pacing_rate
+};
+
+static const congestion_ops_t ledbat_ops =
+{
+    "ledbat",
+    ledbat_init,
+    ledbat_on_ack,
+    ledbat_on_loss,
+    ledbat_on_rto,
+    ledbat_undo,
+    window_pacing_rate
+};
+
+/* indexed by MYSOCK_CC_* */
+static const congestion_ops_t *congestion_algorithms[MYSOCK_NUM_CC] =
+{
+    &reno_ops,
+    &cubic_ops,
+    &bbr_ops,
+    &ledbat_ops
+};
+
+
+/* set up cc to run the given MYSOCK_CC_* algorithm */
+void congestion_init(congestion_t *cc, int algorithm, uint32_t mss)
+{
+    assert(cc && mss > 0);
+    assert(algorithm >= 0 && algorithm < MYSOCK_NUM_CC);
+
+    memset(cc, 0, sizeof(*cc));
+    cc->ops = congestion_algorithms[algorithm];
+    cc->mss = mss;
+    cc->ops->init(cc);
+}
+
+/* the MYSOCK_CC_* value of the algorithm called name, or -1 if none is */
+int congestion_lookup(const char *name)
+{
+    assert(name);
+
+    for (int i = 0; i < MYSOCK_NUM_CC; i++)
+    {
+        if (!strcmp(name, congestion_algorithms[i]->name))
+            return i;
+    }
+    return -1;
+}
+
+
+/* start in slow start with the standard initial window */
+static void slow_start_init(congestion_t *cc)
+{
+    cc->congestion_win = INITIAL_WINDOW(cc);
+    cc->ssthresh = SSTHRESH_INITIAL;
+}
+
+/* don't inflate the window while the application or the peer's receive
+ * window, rather than the congestion window, is what limits us.  data held
+ * back by pacing at our own rate counts as window limited: the pacer only
+ * spreads the window out, and would otherwise stall its growth
+ */
+static bool_t window_limited(const congestion_t *cc,
+                             const congestion_ack_t *ack)
+{
+    return ack->pace_limited ||
+           ack->prior_in_flight + cc->mss >= cc->congestion_win;
+}
+
+/* spread a window over a round trip; faster in slow start so pacing
+ * doesn't hold back the window's growth
+ */
+static uint64_t window_pacing_rate(const congestion_t *cc, uint32_t srtt)
+{
+    uint64_t rate;
+
+    if (!srtt)
+        return 0;
+
+    rate = (uint64_t) cc->congestion_win * 1000000 / srtt;
+    return (cc->congestion_win < cc->ssthresh) ? rate * 2 : rate * 6 / 5;
+}
+
+/* put back the window and threshold from before a spurious reduction,
+ * keeping any growth since
+ */
+static void window_undo(congestion_t *cc, const congestion_t *prior)
+{
+    cc->congestion_win = std::max(cc->congestion_win, prior->congestion_win);
+    cc->ssthresh = std::max(cc->ssthresh, prior->ssthresh);
+}
+
+
+/**********************************RENO***********************************/
+
+/* grow the window for newly acknowledged data: exponentially in slow start,
+ * by about one MSS per round trip in congestion avoidance
+ */
+static void reno_on_ack(congestion_t *cc, const congestion_ack_t *ack)
+{
+    if (!window_limited(cc, ack))
+        return;
+
+    if (cc->congestion_win < cc->ssthresh)
+        cc->congestion_win += std::min(ack->bytes_acked, ABC_LIMIT(cc));
+    else
+        cc->congestion_win += std::max((uint32_t) 1,
+                                       cc->mss * ack->bytes_acked / cc->congestion_win);
+}
+
+/* multiplicative decrease: halve the window and carry on from there */
+static void reno_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    cc->ssthresh = std::max(in_flight / 2, MIN_SSTHRESH(cc));
+    cc->congestion_win = cc->ssthresh;
+}
+
+/* halve the threshold and restart from a one-segment window */
+static void reno_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    cc->ssthresh = std::max(in_flight / 2, MIN_SSTHRESH(cc));
+    cc->congestion_win = cc->mss;
+}
+
+
+/**********************************CUBIC**********************************/
+
+static void cubic_init(congestion_t *cc)
+{
+    slow_start_init(cc);
+    cc->u.cubic.epoch_start = 0;
+    cc->u.cubic.w_max = 0;
+}
+
+/* outside slow start the window follows W(t) = C (t - K)^3 + W_max, in
+ * segments and seconds since the last reduction, so it climbs quickly back
+ * towards the window where loss last happened, plateaus there, and then
+ * probes beyond it.  it never grows slower than Reno would.
+ */
+static void cubic_on_ack(congestion_t *cc, const congestion_ack_t *ack)
+{
+    double t, target;
+    uint32_t cwnd = cc->congestion_win;
+
+    if (!window_limited(cc, ack))
+        return;
+
+    if (cwnd < cc->ssthresh)
+    {
+        cc->congestion_win += std::min(ack->bytes_acked, ABC_LIMIT(cc));
+        return;
+    }
+
+    if (!cc->u.cubic.epoch_start)
+    {
+        cc->u.cubic.epoch_start = ack->now;
+        if (cwnd < cc->u.cubic.w_max)
+        {
+            cc->u.cubic.k = cbrt((double) (cc->u.cubic.w_max - cwnd) /
+                                 cc->mss / CUBIC_C);
+            cc->u.cubic.origin_win = cc->u.cubic.w_max;
+        }
+        else
+        {
+            cc->u.cubic.k = 0;
+            cc->u.cubic.origin_win = cwnd;
+        }
+        cc->u.cubic.w_est = cwnd;
+    }
+
+    /* aim for where the curve will be one RTT from now */
+    t = (double) (ack->now - cc->u.cubic.epoch_start + ack->srtt) / 1000000;
+    target = cc->u.cubic.origin_win +
+             CUBIC_C * pow(t - cc->u.cubic.k, 3) * cc->mss;
+    target = std::max((double) cwnd, std::min(target, 1.5 * cwnd));
+
+    /* Reno-friendly region: average AIMD growth for beta = 0.7 */
+    cc->u.cubic.w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) *
+                         cc->mss * ack->bytes_acked / cwnd;
+
+    if (cc->u.cubic.w_est > target)
+        cc->congestion_win = (uint32_t) cc->u.cubic.w_est;
+    else
+        cc->congestion_win += std::max((uint32_t) 1, (uint32_t)
+            ((target - cwnd) * ack->bytes_acked / cwnd));
+}
+
+/* remember where loss happened (a bit lower if the previous plateau was
+ * higher still, to give way to newer flows) and back off to beta
+ */
+static void cubic_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    uint32_t cwnd = cc->congestion_win;
+
+    cc->u.cubic.epoch_start = 0;
+    if (cwnd < cc->u.cubic.w_max)
+        cc->u.cubic.w_max = (uint32_t) (cwnd * (1 + CUBIC_BETA) / 2);
+    else
+        cc->u.cubic.w_max = cwnd;
+
+    cc->ssthresh = std::max((uint32_t) (cwnd * CUBIC_BETA), MIN_SSTHRESH(cc));
+    cc->congestion_win = cc->ssthresh;
+}
+
+static void cubic_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    cubic_on_loss(cc, now, in_flight);
+    cc->congestion_win = cc->mss;
+}
+
+/* go back to the curve we were on; a new epoch starts from there */
+static void cubic_undo(congestion_t *cc, const congestion_t *prior)
+{
+    window_undo(cc, prior);
+    cc->u.cubic = prior->u.cubic;
+    cc->u.cubic.epoch_start = 0;
+}
+
+
+/***********************************BBR***********************************/
+
+/* rather than reacting to loss, BBR keeps a model of the path--the
+ * bottleneck bandwidth (windowed maximum of delivery rate samples) and the
+ * round-trip propagation delay (windowed minimum RTT)--and sizes the window
+ * to a small multiple of their product, so queues at the bottleneck stay
+ * short.  it cycles through startup (find the bandwidth), drain (empty the
+ * queue startup built), probe bw (mostly cruise, occasionally probe up) and
+ * probe rtt (briefly shrink the window to re-measure the minimum RTT).
+ */
+static void bbr_init(congestion_t *cc)
+{
+    slow_start_init(cc);
+    cc->u.bbr.mode = BBR_STARTUP;
+    cc->u.bbr.pacing_gain = BBR_HIGH_GAIN;
+    cc->u.bbr.cwnd_gain = BBR_HIGH_GAIN;
+}
+
+static void bbr_on_ack(congestion_t *cc, const congestion_ack_t *ack)
+{
+    uint32_t target;
+
+    bbr_update_model(cc, ack);
+    bbr_update_mode(cc, ack);
+
+    /* grow towards the modelled window; before the pipe is known to be
+     * full, keep growing as in slow start
+     */
+    target = bbr_bdp(cc, cc->u.bbr.cwnd_gain) + 3 * cc->mss;
+    if (cc->u.bbr.filled_pipe)
+        cc->congestion_win = std::min(cc->congestion_win + ack->bytes_acked,
+                                      target);
+    else if (cc->congestion_win < target ||
+             ack->delivered < INITIAL_WINDOW(cc))
+        cc->congestion_win += ack->bytes_acked;
+
+    cc->congestion_win = std::max(cc->congestion_win, BBR_MIN_WINDOW(cc));
+    if (cc->u.bbr.mode == BBR_PROBE_RTT)
+        cc->congestion_win = std::min(cc->congestion_win, BBR_MIN_WINDOW(cc));
+}
+
+/* loss isn't treated as a congestion signal; the model already caps the
+ * amount in flight
+ */
+static void bbr_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+}
+
+/* after a timeout restart from a minimal window; subsequent ACKs grow it
+ * straight back to the model's target
+ */
+static void bbr_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    cc->u.bbr.prior_cwnd = std::max(cc->u.bbr.prior_cwnd, cc->congestion_win);
+    cc->congestion_win = cc->mss;
+}
+
+static uint64_t bbr_pacing_rate(const congestion_t *cc, uint32_t srtt)
+{
+    /* no bandwidth estimate yet: pace the initial window at startup gain */
+    if (!cc->u.bbr.btl_bw)
+        return srtt ? (uint64_t) (BBR_HIGH_GAIN * cc->congestion_win *
+                                  1000000 / srtt) : 0;
+
+    return (uint64_t) (cc->u.bbr.pacing_gain * cc->u.bbr.btl_bw);
+}
+
+/* estimated bandwidth-delay product scaled by gain, in bytes */
+static uint32_t bbr_bdp(const congestion_t *cc, double gain)
+{
+    if (!cc->u.bbr.btl_bw || !cc->u.bbr.min_rtt)
+        return INITIAL_WINDOW(cc);
+
+    return (uint32_t) (gain * cc->u.bbr.btl_bw * cc->u.bbr.min_rtt / 1000000);
+}
+
+/* fold this ACK's rate and RTT samples into the path model */
+static void bbr_update_model(congestion_t *cc, const congestion_ack_t *ack)
+{
+    uint64_t *slot;
+    int k;
+
+    /* a round trip ends when data sent after the previous round started
+     * is acknowledged
+     */
+    cc->u.bbr.round_start = FALSE;
+    if (ack->packet_delivered >= cc->u.bbr.next_round_delivered)
+    {
+        cc->u.bbr.next_round_delivered = ack->delivered;
+        ++cc->u.bbr.round_count;
+        cc->u.bbr.round_start = TRUE;
+        cc->u.bbr.bw_rounds[cc->u.bbr.round_count % BBR_BW_ROUNDS] = 0;
+    }
+
+    /* samples taken while the app was idle understate the bandwidth, so
+     * only use them if they raise the estimate
+     */
+    slot = &cc->u.bbr.bw_rounds[cc->u.bbr.round_count % BBR_BW_ROUNDS];
+    if (ack->delivery_rate &&
+        (!ack->app_limited || ack->delivery_rate >= cc->u.bbr.btl_bw))
+        *slot = std::max(*slot, ack->delivery_rate);
+
+    cc->u.bbr.btl_bw = 0;
+    for (k = 0; k < BBR_BW_ROUNDS; ++k)
+        cc->u.bbr.btl_bw = std::max(cc->u.bbr.btl_bw, cc->u.bbr.bw_rounds[k]);
+
+    if (ack->rtt &&
+        (!cc->u.bbr.min_rtt || ack->rtt <= cc->u.bbr.min_rtt ||
+         ack->now > cc->u.bbr.min_rtt_stamp + BBR_MIN_RTT_WINDOW))
+    {
+        cc->u.bbr.min_rtt = ack->rtt;
+        cc->u.bbr.min_rtt_stamp = ack->now;
+    }
+
+    /* startup is over once the bandwidth stops growing by 25% a round */
+    if (!cc->u.bbr.filled_pipe && cc->u.bbr.round_start && !ack->app_limited)
+    {
+        if (cc->u.bbr.btl_bw >= cc->u.bbr.full_bw * BBR_FULL_BW_GROWTH)
+        {
+            cc->u.bbr.full_bw = cc->u.bbr.btl_bw;
+            cc->u.bbr.full_bw_count = 0;
+        }
+        else if (++cc->u.bbr.full_bw_count >= BBR_FULL_BW_ROUNDS)
+        {
+            cc->u.bbr.filled_pipe = TRUE;
+        }
+    }
+}
+
+/* move between the startup/drain/probe bw/probe rtt modes */
+static void bbr_update_mode(congestion_t *cc, const congestion_ack_t *ack)
+{
+    if (cc->u.bbr.mode == BBR_STARTUP && cc->u.bbr.filled_pipe)
+    {
+        cc->u.bbr.mode = BBR_DRAIN;
+        cc->u.bbr.pacing_gain = 1 / BBR_HIGH_GAIN;
+        cc->u.bbr.cwnd_gain = BBR_HIGH_GAIN;
+    }
+
+    if (cc->u.bbr.mode == BBR_DRAIN && ack->in_flight <= bbr_bdp(cc, 1.0))
+    {
+        cc->u.bbr.mode = BBR_PROBE_BW;
+        cc->u.bbr.cwnd_gain = BBR_CWND_GAIN;
+        /* start anywhere but the drain phase, so flows desynchronise */
+        cc->u.bbr.cycle_index = (int) (ack->now % (BBR_CYCLE_LEN - 1));
+        if (cc->u.bbr.cycle_index >= 1)
+            ++cc->u.bbr.cycle_index;
+        cc->u.bbr.cycle_stamp = ack->now;
+        cc->u.bbr.pacing_gain = bbr_cycle_gains[cc->u.bbr.cycle_index];
+    }
+
+    /* one gain phase per min RTT */
+    if (cc->u.bbr.mode == BBR_PROBE_BW &&
+        ack->now - cc->u.bbr.cycle_stamp > cc->u.bbr.min_rtt)
+    {
+        cc->u.bbr.cycle_index = (cc->u.bbr.cycle_index + 1) % BBR_CYCLE_LEN;
+        cc->u.bbr.cycle_stamp = ack->now;
+        cc->u.bbr.pacing_gain = bbr_cycle_gains[cc->u.bbr.cycle_index];
+    }
+
+    /* the min RTT estimate is stale: drain the pipe to re-measure it */
+    if (cc->u.bbr.mode != BBR_PROBE_RTT && cc->u.bbr.min_rtt &&
+        ack->now > cc->u.bbr.min_rtt_stamp + BBR_MIN_RTT_WINDOW)
+    {
+        cc->u.bbr.mode = BBR_PROBE_RTT;
+        cc->u.bbr.pacing_gain = 1;
+        cc->u.bbr.prior_cwnd = cc->congestion_win;
+        cc->u.bbr.probe_rtt_done_stamp = 0;
+    }
+
+    if (cc->u.bbr.mode == BBR_PROBE_RTT)
+    {
+        if (!cc->u.bbr.probe_rtt_done_stamp &&
+            ack->in_flight <= BBR_MIN_WINDOW(cc))
+        {
+            cc->u.bbr.probe_rtt_done_stamp = ack->now + BBR_PROBE_RTT_TIME;
+            cc->u.bbr.probe_rtt_round_done = FALSE;
+            cc->u.bbr.next_round_delivered = ack->delivered;
+        }
+        else if (cc->u.bbr.probe_rtt_done_stamp)
+        {
+            if (cc->u.bbr.round_start)
+                cc->u.bbr.probe_rtt_round_done = TRUE;
+
+            if (cc->u.bbr.probe_rtt_round_done &&
+                ack->now > cc->u.bbr.probe_rtt_done_stamp)
+            {
+                cc->u.bbr.min_rtt_stamp = ack->now;
+                cc->congestion_win = std::max(cc->congestion_win,
+                                              cc->u.bbr.prior_cwnd);
+                if (cc->u.bbr.filled_pipe)
+                {
+                    cc->u.bbr.mode = BBR_PROBE_BW;
+                    cc->u.bbr.cwnd_gain = BBR_CWND_GAIN;
+                    cc->u.bbr.cycle_stamp = ack->now;
+                    cc->u.bbr.pacing_gain =
+                        bbr_cycle_gains[cc->u.bbr.cycle_index];
+                }
+                else
+                {
+                    cc->u.bbr.mode = BBR_STARTUP;
+                    cc->u.bbr.pacing_gain = BBR_HIGH_GAIN;
+                    cc->u.bbr.cwnd_gain = BBR_HIGH_GAIN;
+                }
+            }
+        }
+    }
+}
+
+
+/**********************************LEDBAT*********************************/
+
+/* a scavenger for background bulk transfers.  the window is steered so the
+ * queueing delay we measure (current delay minus the lowest delay seen over
+ * the last several minutes) stays under a fixed target: below it the window
+ * grows by up to one MSS per RTT, above it the window shrinks in proportion,
+ * so the flow backs off as soon as anyone else starts filling the queue.
+ * delays are taken from RTT samples, as no one-way delay is available.
+ */
+static void ledbat_init(congestion_t *cc)
+{
+    slow_start_init(cc);
+}
+
+static void ledbat_on_ack(congestion_t *cc, const congestion_ack_t *ack)
+{
+    uint32_t queueing_delay, max_allowed;
+    double off_target;
+    int32_t delta;
+
+    if (!ack->rtt)
+        return;
+
+    queueing_delay = ledbat_queueing_delay(cc, ack->now, ack->rtt);
+
+    /* slow start only until the queue begins to build */
+    if (cc->congestion_win < cc->ssthresh)
+    {
+        if (queueing_delay < LEDBAT_TARGET / 2)
+        {
+            if (window_limited(cc, ack))
+                cc->congestion_win += std::min(ack->bytes_acked, ABC_LIMIT(cc));
+            return;
+        }
+        cc->ssthresh = cc->congestion_win;
+    }
+
+    off_target = (double) ((int32_t) LEDBAT_TARGET - (int32_t) queueing_delay) /
+                 LEDBAT_TARGET;
+    delta = (int32_t) (LEDBAT_GAIN * off_target * ack->bytes_acked * cc->mss /
+                       cc->congestion_win);
+
+    /* growth must also be earned by actually using the window */
+    if (delta > 0 && !window_limited(cc, ack))
+        delta = 0;
+
+    if (delta < 0 && (uint32_t) -delta > cc->congestion_win)
+        cc->congestion_win = 0;
+    else
+        cc->congestion_win += delta;
+
+    max_allowed = ack->prior_in_flight + cc->mss;
+    cc->congestion_win = std::min(cc->congestion_win,
+                                  std::max(max_allowed, LEDBAT_MIN_WINDOW(cc)));
+    cc->congestion_win = std::max(cc->congestion_win, LEDBAT_MIN_WINDOW(cc));
+}
+
+/* halve on loss, at most once per round trip */
+static void ledbat_on_loss(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    uint32_t min_delay = cc->u.ledbat.base_delays[cc->u.ledbat.base_index];
+
+    if (cc->u.ledbat.last_reduction &&
+        now - cc->u.ledbat.last_reduction < min_delay)
+        return;
+
+    cc->u.ledbat.last_reduction = now;
+    cc->congestion_win = std::max(cc->congestion_win / 2,
+                                  LEDBAT_MIN_WINDOW(cc));
+    cc->ssthresh = cc->congestion_win;
+}
+
+/* the reduction didn't count, so the next loss may cut again straight away */
+static void ledbat_undo(congestion_t *cc, const congestion_t *prior)
+{
+    window_undo(cc, prior);
+    cc->u.ledbat.last_reduction = prior->u.ledbat.last_reduction;
+}
+
+static void ledbat_on_rto(congestion_t *cc, uint64_t now, uint32_t in_flight)
+{
+    cc->ssthresh = std::max(cc->congestion_win / 2, LEDBAT_MIN_WINDOW(cc));
+    cc->congestion_win = cc->mss;
+    cc->u.ledbat.last_reduction = now;
+}
+
+/* feed a delay sample (usec) through the base and current delay filters,
+ * returning the resulting queueing delay estimate
+ */
+static uint32_t ledbat_queueing_delay(congestion_t *cc, uint64_t now,
+                                      uint32_t delay)
+{
+    uint32_t base_delay = 0, current_delay = 0;
+    int k;
+
+    /* base delay: minimum per minute, over the last few minutes */
+    if (!cc->u.ledbat.base_stamp)
+    {
+        cc->u.ledbat.base_stamp = now;
+        cc->u.ledbat.base_delays[cc->u.ledbat.base_index] = delay;
+    }
+    else if (now - cc->u.ledbat.base_stamp >= LEDBAT_BASE_INTERVAL)
+    {
+        cc->u.ledbat.base_stamp = now;
+        cc->u.ledbat.base_index =
+            (cc->u.ledbat.base_index + 1) % LEDBAT_BASE_HISTORY;
+        cc->u.ledbat.base_delays[cc->u.ledbat.base_index] = delay;
+    }
+    else
+    {
+        uint32_t *slot = &cc->u.ledbat.base_delays[cc->u.ledbat.base_index];
+        *slot = std::min(*slot, delay);
+    }
+
+    for (k = 0; k < LEDBAT_BASE_HISTORY; ++k)
+    {
+        uint32_t d = cc->u.ledbat.base_delays[k];
+        if (d && (!base_delay || d < base_delay))
+            base_delay = d;
+    }
+
+    /* current delay: minimum of the last few samples, to filter noise */
+    cc->u.ledbat.current_delays[cc->u.ledbat.current_index] = delay;
+    cc->u.ledbat.current_index =
+        (cc->u.ledbat.current_index + 1) % LEDBAT_CURRENT_FILTER;
+    if (cc->u.ledbat.current_count < LEDBAT_CURRENT_FILTER)
+        ++cc->u.ledbat.current_count;
+
+    for (k = 0; k < cc->u.ledbat.current_count; ++k)
+    {
+        uint32_t d = cc->u.ledbat.current_delays[k];
+        if (!current_delay || d < current_delay)
+            current_delay = d;
+    }
+
+    return (current_delay > base_delay) ? current_delay - base_delay : 0;
+}
@@ -0,0 +1,133 @@
+/* congestion.h--congestion control algorithms for the transport layer.
+ * this is an internal header, used only by transport.c and mysock_api.c.
+ */
+
+#ifndef __CONGESTION_H__
+#define __CONGESTION_H__
+
+#include "mysock.h"
+
+
+/* number of round trips over which BBR takes its bandwidth maximum */
+#define BBR_BW_ROUNDS 10
+
+/* LEDBAT delay filters: minutes of base delay history, and the number of
+ * recent samples whose minimum is the current delay
+ */
+#define LEDBAT_BASE_HISTORY   10
+#define LEDBAT_CURRENT_FILTER 4
+
+/* what the transport layer learned from one acknowledgement */
+typedef struct
+{
+    uint64_t now;               /* arrival time (usec) */
+    uint32_t bytes_acked;       /* bytes newly acknowledged by this ACK */
+    uint32_t prior_in_flight;   /* bytes outstanding before the ACK */
+    uint32_t in_flight;         /* bytes still outstanding after the ACK */
+    uint32_t rtt;               /* RTT sample (usec), or 0 if none (Karn) */
+    uint32_t srtt;              /* smoothed RTT (usec), or 0 if unknown */
+
+    /* delivery rate sample, for model-based algorithms */
+    uint64_t delivered;         /* total bytes delivered, including these */
+    uint64_t packet_delivered;  /* delivered when the acked data was sent */
+    uint64_t delivery_rate;     /* bytes/sec, or 0 if no sample */
+    bool_t   app_limited;       /* sample taken while the app was idle */
+    bool_t   pace_limited;      /* data was waiting on the pacer */
+} congestion_ack_t;
+
+struct congestion_ops;
+
+/* per-connection congestion control state.  congestion_win and ssthresh
+ * are maintained by the selected algorithm; the transport layer only reads
+ * them when working out how much it may send.
+ */
+typedef struct
+{
+    const struct congestion_ops *ops;
+
+    uint32_t mss;               /* sender maximum segment size */
+    uint32_t congestion_win;    /* congestion window (bytes) */
+    uint32_t ssthresh;          /* slow start threshold (bytes) */
+
+    /* algorithm-specific working state */
+    union
+    {
+        struct
+        {
+            uint32_t w_max;         /* window before the last reduction */
+            uint32_t origin_win;    /* plateau of the current cubic epoch */
+            double   w_est;         /* Reno-friendly window estimate */
+            uint64_t epoch_start;   /* usec, 0 when no epoch is running */
+            double   k;             /* seconds until the plateau is reached */
+        } cubic;
+
+        struct
+        {
+            int      mode;          /* startup, drain, probe bw/rtt */
+            uint64_t bw_rounds[BBR_BW_ROUNDS];  /* max rate per round */
+            uint64_t btl_bw;        /* bottleneck bandwidth (bytes/sec) */
+            uint32_t min_rtt;       /* usec, 0 until the first sample */
+            uint64_t min_rtt_stamp; /* when min_rtt was last measured */
+            uint64_t next_round_delivered;
+            uint32_t round_count;   /* packet-timed round trips so far */
+            bool_t   round_start;   /* this ACK started a new round */
+            uint64_t full_bw;       /* startup: best rate seen so far */
+            int      full_bw_count; /* rounds without 25% growth */
+            bool_t   filled_pipe;
+            int      cycle_index;   /* position in the probe bw gain cycle */
+            uint64_t cycle_stamp;
+            uint64_t probe_rtt_done_stamp;
+            bool_t   probe_rtt_round_done;
+            uint32_t prior_cwnd;    /* restored on leaving probe rtt */
+            double   pacing_gain;
+            double   cwnd_gain;
+        } bbr;
+
+        struct
+        {
+            uint32_t base_delays[LEDBAT_BASE_HISTORY]; /* min per minute */
+            int      base_index;
+            uint64_t base_stamp;    /* start of the current minute */
+            uint32_t current_delays[LEDBAT_CURRENT_FILTER];
+            int      current_index;
+            int      current_count;
+            uint64_t last_reduction;    /* at most one loss cut per RTT */
+        } ledbat;
+    } u;
+} congestion_t;
+
+/* operations implemented by each congestion control algorithm */
+typedef struct congestion_ops
+{
+    const char *name;
+
+    void (*init)(congestion_t *cc);
+
+    /* new data was cumulatively acknowledged */
+    void (*on_ack)(congestion_t *cc, const congestion_ack_t *ack);
+
+    /* loss detected without a timeout (e.g. fast retransmit) */
+    void (*on_loss)(congestion_t *cc, uint64_t now, uint32_t in_flight);
+
+    /* the retransmission timer fired */
+    void (*on_rto)(congestion_t *cc, uint64_t now, uint32_t in_flight);
+
+    /* the last loss or timeout turned out to be spurious; prior is the
+     * state saved just before reacting to it
+     */
+    void (*undo)(congestion_t *cc, const congestion_t *prior);
+
+    /* rate (bytes/sec) at which segments should be paced out, or 0 to send
+     * whenever the window allows
+     */
+    uint64_t (*pacing_rate)(const congestion_t *cc, uint32_t srtt);
+} congestion_ops_t;
+
+
+/* set up cc to run the given MYSOCK_CC_* algorithm */
+void congestion_init(congestion_t *cc, int algorithm, uint32_t mss);
+
+/* the MYSOCK_CC_* value of the algorithm called name, or -1 if none is */
+int congestion_lookup(const char *name);
+
+#endif  /* __CONGESTION_H__ */
@@ -220,6 +220,11 @@ bool_t _mysock_enqueue_connection(mysock_context_t      *ctx,
 
         new_ctx = _mysock_get_context(queue_entry->sd);
         new_ctx->listen_sd = ctx->my_sd;
+        new_ctx->congestion_control = ctx->congestion_control;
+        new_ctx->ack_mode = ctx->ack_mode;
+        new_ctx->nodelay = ctx->nodelay;
+        new_ctx->max_rate = ctx->max_rate;
+        new_ctx->jumbo = ctx->jumbo;
 
         new_ctx->network_state.peer_addr       = *peer_addr;
         new_ctx->network_state.peer_addr_len   = peer_addr_len;
@@ -29,6 +29,7 @@ static void verify_mysocket_descriptor(mysock_context_t *comp_ctx,
                                        mysocket_t        my_sd);
 static mysock_context_t *_mysock_allocate_context(void);
 static bool_t _mysock_free_queue(mysock_context_t *ctx, packet_queue_t *pq);
+static void _mysock_timer_expired(wheel_timer_t *timer);
 
 
 /* mysocket descriptor table, one entry per STCP connection */
@@ -160,6 +161,7 @@ void _mysock_enqueue_buffer(mysock_context_t *ctx,
         pq->tail->next = node;
         pq->tail = node;
     }
+    pq->bytes += packet_len;
     PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
     PTHREAD_CALL(pthread_cond_broadcast(&ctx->data_ready_cond));
 }
@@ -198,6 +200,7 @@ size_t _mysock_dequeue_buffer(mysock_context_t *ctx,
         /* remove only a portion of the packet at the head of the queue,
          * leaving the rest around for the next call to dequeue_buffer().
          */
+        pq->bytes -= max_len;
         PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
 
         memcpy(dst, node->data, max_len);
@@ -213,6 +216,7 @@ size_t _mysock_dequeue_buffer(mysock_context_t *ctx,
             assert(pq->tail == node);
             pq->tail = NULL;
         }
+        pq->bytes -= node->data_len;
         PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
 
         memcpy(dst, node->data, MIN(max_len, node->data_len));
@@ -262,6 +266,7 @@ static bool_t _mysock_free_queue(mysock_context_t *ctx, packet_queue_t *pq)
 static mysock_context_t *_mysock_allocate_context(void)
 {
     mysock_context_t *ctx = 0;
+    int k;
 
     ctx = (mysock_context_t *) calloc(1, sizeof(mysock_context_t));
     assert(ctx);
@@ -284,6 +289,9 @@ static mysock_context_t *_mysock_allocate_context(void)
 
     ctx->blocking = TRUE;   /* we unblock once we're connected */
 
+    for (k = 0; k < STCP_MAX_TIMERS; ++k)
+        _timer_init(&ctx->timers[k], _mysock_timer_expired, ctx);
+
 
     /* initialise underlying network state.  this includes creating the actual
      * socket used for communication to the peer--this is analogous to the
@@ -308,6 +316,9 @@ void _mysock_free_context(mysock_context_t *ctx)
 
     assert(ctx);
 
+    /* no timer may fire once the locks it takes are gone */
+    _mysock_cancel_timers(ctx);
+
     PTHREAD_CALL(pthread_cond_destroy(&ctx->blocking_cond));
     PTHREAD_CALL(pthread_mutex_destroy(&ctx->blocking_lock));
 
@@ -334,6 +345,30 @@ void _mysock_free_context(mysock_context_t *ctx)
     free(ctx);
 }
 
+/* stop all of a connection's timers.  once this returns, none of them is
+ * running or will fire.
+ */
+void _mysock_cancel_timers(mysock_context_t *ctx)
+{
+    int k;
+
+    assert(ctx);
+    for (k = 0; k < STCP_MAX_TIMERS; ++k)
+        _timer_cancel(&ctx->timers[k]);
+}
+
+/* called on the timer thread when one of a connection's timers expires */
+static void _mysock_timer_expired(wheel_timer_t *timer)
+{
+    mysock_context_t *ctx = (mysock_context_t *) timer->arg;
+
+    assert(ctx);
+    PTHREAD_CALL(pthread_mutex_lock(&ctx->data_ready_lock));
+    ctx->timers_fired |= 1u << (timer - ctx->timers);
+    PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
+    PTHREAD_CALL(pthread_cond_broadcast(&ctx->data_ready_cond));
+}
+
 /* transport layer thread; transport_init() should not return until the
  * transport layer finishes (i.e. the connection is over).
  */
@@ -358,6 +393,7 @@ static void *transport_thread_func(void *arg_ptr)
     /* transport_init() has returned; both sides have closed the connection,
      * do some final cleanup here...
      */
+    _mysock_cancel_timers(ctx);
 
     PTHREAD_CALL(pthread_mutex_lock(&ctx->blocking_lock));
     if (ctx->blocking)
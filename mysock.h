@@ -27,6 +27,35 @@ typedef int bool_t;
 typedef int mysocket_t;     /* mysocket descriptor */
 
 
+/* mysetsockopt() options.  these must be set before myconnect(); options
+ * set on a listening mysocket are inherited by the connections it accepts.
+ */
+#define MYSOCK_OPT_CONGESTION   1   /* int, one of the MYSOCK_CC_* values */
+#define MYSOCK_OPT_ACK_MODE     2   /* int, one of the MYSOCK_ACK_* values */
+#define MYSOCK_OPT_NODELAY      3   /* int, nonzero disables Nagle's algorithm */
+#define MYSOCK_OPT_MAX_RATE     4   /* unsigned int, pacing cap in bytes/sec */
+#define MYSOCK_OPT_JUMBO        5   /* int, nonzero allows 64KB super-frames */
+
+/* congestion control algorithms */
+enum
+{
+    MYSOCK_CC_RENO,     /* loss-based AIMD (the default) */
+    MYSOCK_CC_CUBIC,    /* loss-based, cubic window growth for high BDP */
+    MYSOCK_CC_BBR,      /* model-based: bottleneck bandwidth and min RTT */
+    MYSOCK_CC_LEDBAT,   /* background: yields when queueing delay rises */
+    MYSOCK_NUM_CC
+};
+
+/* how the receiver acknowledges in-order data */
+enum
+{
+    MYSOCK_ACK_DELAYED,     /* every second segment, or after 40ms (default) */
+    MYSOCK_ACK_ADAPTIVE,    /* delayed, thinned further at high data rates */
+    MYSOCK_ACK_IMMEDIATE,   /* every segment */
+    MYSOCK_NUM_ACK_MODES
+};
+
+
 /* maximum number of mysockets per process */
 #define MAX_NUM_CONNECTIONS 64
 
@@ -47,6 +76,13 @@ extern int mygetsockname(mysocket_t sd, struct sockaddr *addr,
                          socklen_t *addrlen);
 extern int mygetpeername(mysocket_t sd, struct sockaddr *addr,
                          socklen_t *addrlen);
+extern int mysetsockopt(mysocket_t sd, int optname, const void *optval,
+                        socklen_t optlen);
+
+/* return the MYSOCK_CC_* value of the congestion control algorithm with the
+ * given name ("reno", "cubic", "bbr" or "ledbat"), or -1 if there is none.
+ */
+extern int mycongestion(const char *name);
 
 /* return IP address of interface on which packets to/from peer_addr are
  * delivered.  peer_addr is in network byte order.
@@ -12,6 +12,7 @@
 #include "mysock_impl.h"
 #include "network_io.h"
 #include "connection_demux.h"
+#include "congestion.h"
 
 
 /* MYSOCK_CHECK(cond,rc) checks that 'cond' is true; if it isn't, error
@@ -118,8 +119,18 @@ mysocket_t myaccept(mysocket_t sd, struct sockaddr *addr, int *addrlen)
     }
 
     assert(ctx->listen_sd == sd);
+    if (ctx->stcp_errno)
+    {
+        /* the application never sees this mysocket, so release it here */
+        int err = ctx->stcp_errno;
+
+        DEBUG_LOG(("***myaccept(%d) failed with error %d***\n", sd, err));
+        myclose(ctx->my_sd);
+        MYSOCK_ERROR_EXIT(err);
+    }
+
     DEBUG_LOG(("***myaccept(%d) returning new sd %d***\n", sd, ctx->my_sd));
-    return (errno = ctx->stcp_errno) ? -1 : ctx->my_sd;
+    return ctx->my_sd;
 }
 
 /* in this implementation, mylisten() is assumed to follow mybind() */
@@ -228,6 +239,18 @@ int myread(mysocket_t sd, void *buf, size_t buf_len)
         /* make sure repeated calls to myread() return 0 on EOF */
         ctx->eof = TRUE;
     }
+    else
+    {
+        bool_t wake;
+
+        /* STCP may be waiting to offer the peer the space we just freed */
+        PTHREAD_CALL(pthread_mutex_lock(&ctx->data_ready_lock));
+        ctx->app_read = TRUE;
+        wake = (ctx->stcp_wait_flags & APP_DATA_READ) != 0;
+        PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
+        if (wake)
+            PTHREAD_CALL(pthread_cond_broadcast(&ctx->data_ready_cond));
+    }
 
     return len;
 }
@@ -279,6 +302,65 @@ int mygetpeername(mysocket_t sd, struct sockaddr *name, socklen_t *namelen)
     return 0;
 }
 
+/* set a per-connection option (see MYSOCK_OPT_* in mysock.h).  options are
+ * read by the transport layer when the connection is set up, so they must
+ * be set before myconnect(), or on the listening mysocket before myaccept().
+ */
+int mysetsockopt(mysocket_t sd, int optname, const void *optval,
+                 socklen_t optlen)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+
+    MYSOCK_CHECK(ctx != NULL, EBADF);
+    MYSOCK_CHECK(optval != NULL, EFAULT);
+    MYSOCK_CHECK(!ctx->transport_thread_started, EISCONN);
+
+    switch (optname)
+    {
+    case MYSOCK_OPT_CONGESTION:
+        MYSOCK_CHECK(optlen == sizeof(int), EINVAL);
+        MYSOCK_CHECK(*(const int *) optval >= 0 &&
+                     *(const int *) optval < MYSOCK_NUM_CC, EINVAL);
+        ctx->congestion_control = *(const int *) optval;
+        break;
+
+    case MYSOCK_OPT_ACK_MODE:
+        MYSOCK_CHECK(optlen == sizeof(int), EINVAL);
+        MYSOCK_CHECK(*(const int *) optval >= 0 &&
+                     *(const int *) optval < MYSOCK_NUM_ACK_MODES, EINVAL);
+        ctx->ack_mode = *(const int *) optval;
+        break;
+
+    case MYSOCK_OPT_NODELAY:
+        MYSOCK_CHECK(optlen == sizeof(int), EINVAL);
+        ctx->nodelay = (*(const int *) optval != 0);
+        break;
+
+    case MYSOCK_OPT_MAX_RATE:
+        MYSOCK_CHECK(optlen == sizeof(unsigned int), EINVAL);
+        ctx->max_rate = *(const unsigned int *) optval;
+        break;
+
+    case MYSOCK_OPT_JUMBO:
+        MYSOCK_CHECK(optlen == sizeof(int), EINVAL);
+        ctx->jumbo = (*(const int *) optval != 0);
+        break;
+
+    default:
+        MYSOCK_ERROR_EXIT(ENOPROTOOPT);
+    }
+
+    return 0;
+}
+
+/* returns the MYSOCK_CC_* value of the congestion control algorithm called
+ * name, or -1 if there is none.
+ */
+int mycongestion(const char *name)
+{
+    return congestion_lookup(name);
+}
+
 /* returns IP address of interface on which packets to/from network address
  * peer_addr (network byte order) are delivered.
  */
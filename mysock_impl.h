@@ -14,6 +14,8 @@
 #include <pthread.h>
 #include "mysock.h"
 #include "network_io.h"
+#include "stcp_api.h"
+#include "timer_wheel.h"
 
 #ifdef __GNUC__
     #define INLINE __inline__
@@ -60,6 +62,7 @@ typedef struct
 {
     packet_queue_node_t *head;
     packet_queue_node_t *tail;
+    size_t               bytes;     /* payload queued, under data_ready_lock */
 } packet_queue_t;
 
 /* mysocket context (and the arguments provided to the transport layer
@@ -71,6 +74,11 @@ typedef struct mysock_context
 {
     /* connection parameters */
     int is_active;      /* true if we're connect()ing, false if accept()ing */
+    int congestion_control; /* MYSOCK_CC_* algorithm used by STCP */
+    int ack_mode;           /* MYSOCK_ACK_* policy used by STCP */
+    int nodelay;            /* send small writes without coalescing them */
+    unsigned int max_rate;  /* pacing cap (bytes/sec), 0 for none */
+    int jumbo;              /* network layer may carry super-frames */
 
     /* student's STCP implementation working state */
     void *stcp_state;
@@ -104,6 +112,20 @@ typedef struct mysock_context
     bool_t          close_requested;    /* myclose() called by app? */
     bool_t          eof;                /* true once peer finishes writing */
 
+    /* STCP's timers, on the shared timer wheel.  an expiring timer sets its
+     * bit in timers_fired (under data_ready_lock) and signals
+     * data_ready_cond.
+     */
+    wheel_timer_t   timers[STCP_MAX_TIMERS];
+    unsigned int    timers_fired;
+
+    /* myread() sets app_read (under data_ready_lock) whenever it consumes
+     * data, but only wakes STCP if stcp_wait_for_event() is waiting for
+     * APP_DATA_READ, as recorded in stcp_wait_flags.
+     */
+    bool_t          app_read;
+    unsigned int    stcp_wait_flags;
+
     /* data sent to peer is sent immediately, so no queue is needed for that
      * case.  we keep a queue for the other three cases:  data coming from
      * peer, data sent to the app for consumption with myread(), and data
@@ -126,6 +148,8 @@ int _mysock_wait_for_connection(mysock_context_t *ctx);
 
 void _mysock_free_context(mysock_context_t *ctx);
 
+void _mysock_cancel_timers(mysock_context_t *ctx);
+
 void _mysock_enqueue_buffer(mysock_context_t *ctx,
                             packet_queue_t   *pq,
                             const void       *packet,
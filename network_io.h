@@ -13,6 +13,12 @@
 
 #define MAX_IP_PAYLOAD_LEN 1500
 
+/* largest packet a length-prefixed stream record can hold; the TCP
+ * backend carries packets up to this size ("super-frames") for mysockets
+ * with MYSOCK_OPT_JUMBO set
+ */
+#define MAX_JUMBO_PAYLOAD_LEN 65535
+
 
 struct mysock_context;
 
@@ -61,6 +67,11 @@ uint32_t _network_get_local_addr(network_context_t *ctx);
  */
 uint32_t _network_get_interface_ip(uint32_t peer_addr);
 
+/* largest STCP packet (header included) the network layer can carry for
+ * this mysocket
+ */
+size_t _network_max_datagram(network_context_t *ctx);
+
 /* send an STCP packet to our peer */
 ssize_t _network_send_packet(network_context_t *ctx,
                              const void *src, size_t len);
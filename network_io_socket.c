@@ -207,7 +207,7 @@ int _network_bind_socket(network_context_t *ctx,
  */
 static void *network_recv_thread_func(void *arg_ptr)
 {
-    char packet_buf[MAX_IP_PAYLOAD_LEN];
+    char packet_buf[MAX_JUMBO_PAYLOAD_LEN];
     mysock_context_t *ctx;
     network_context_socket_t *net_ctx;
 
@@ -5,6 +5,8 @@
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <alloca.h>
@@ -18,7 +20,9 @@
 typedef ssize_t (*io_func_t)(socket_t sd, void *buf, size_t count);
 
 static int _tcp_io(socket_t, void *, size_t, io_func_t);
+static int _tcp_writev(socket_t tcp_sd, struct iovec *iov, int iovcnt);
 static int _tcp_connect(network_context_t *ctx);
+static void _tcp_nodelay(socket_t tcp_sd);
 
 
 /* a few words about using TCP to emulate the underlying datagram
@@ -131,14 +135,33 @@ void _network_update_passive_state(network_context_t *new_ctx,
 }
 
 
+/* packets travel as a length-prefixed record on the TCP stream, so only
+ * the 16-bit length limits them.  they are kept within an IP datagram's
+ * payload unless the mysocket asked for super-frames
+ */
+size_t _network_max_datagram(network_context_t *ctx)
+{
+    network_context_socket_tcp_t *tcp_io_ctx;
+
+    assert(ctx);
+
+    tcp_io_ctx = (network_context_socket_tcp_t *) ctx->impl_data;
+    assert(tcp_io_ctx && tcp_io_ctx->sock_ctx);
+
+    return tcp_io_ctx->sock_ctx->jumbo ? MAX_JUMBO_PAYLOAD_LEN
+                                       : MAX_IP_PAYLOAD_LEN;
+}
+
 /* send the given packet to the peer */
 ssize_t _network_send_packet(network_context_t *ctx,
                              const void *src, size_t len)
 {
     network_context_socket_tcp_t *tcp_io_ctx;
     uint16_t packet_len;    /* network byte order */
+    struct iovec iov[2];
 
     assert(ctx && src);
+    assert(len <= MAX_JUMBO_PAYLOAD_LEN);
     assert(ctx->peer_addr_len > 0);
 
     tcp_io_ctx = (network_context_socket_tcp_t *) ctx->impl_data;
@@ -150,10 +173,13 @@ ssize_t _network_send_packet(network_context_t *ctx,
     if (_tcp_connect(ctx) < 0)
         return -1;
 
+    /* the length and the packet go in one system call */
     packet_len = htons(len);
-    if (_tcp_io(GET_SOCKET(ctx), &packet_len, sizeof(packet_len),
-                (io_func_t) write) < 0 ||
-        _tcp_io(GET_SOCKET(ctx), (void *) src, len, (io_func_t) write) < 0)
+    iov[0].iov_base = &packet_len;
+    iov[0].iov_len = sizeof(packet_len);
+    iov[1].iov_base = (void *) src;
+    iov[1].iov_len = len;
+    if (_tcp_writev(GET_SOCKET(ctx), iov, 2) < 0)
         return -1;
 
     return len;
@@ -201,6 +227,7 @@ ssize_t _network_recv_packet(network_context_t *ctx, void *dst, size_t max_len)
          * socket updated to be 'new_socket'
          */
         assert(tcp_io_ctx->new_socket == -1);
+        _tcp_nodelay(tmp_sd);
         tcp_io_ctx->new_socket = tmp_sd;
         io_socket = tmp_sd;
     }
@@ -264,6 +291,34 @@ static int _tcp_io(socket_t tcp_sd, void *buf, size_t count, io_func_t io_func)
     return count;
 }
 
+/* write out everything in the given buffers, picking up where the stream
+ * left off if it takes only part of them
+ */
+static int _tcp_writev(socket_t tcp_sd, struct iovec *iov, int iovcnt)
+{
+    assert(iov && iovcnt > 0);
+    while (iovcnt > 0)
+    {
+        ssize_t rc;
+
+        if ((rc = writev(tcp_sd, iov, iovcnt)) <= 0)
+        {
+            DEBUG_LOG(("_tcp_writev rc: %d\n", (int) rc));
+            return (int) rc;
+        }
+
+        for (; iovcnt > 0 && (size_t) rc >= iov->iov_len; ++iov, --iovcnt)
+            rc -= iov->iov_len;
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *) iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    return 0;
+}
+
 static int _tcp_connect(network_context_t *ctx)
 {
     network_context_socket_tcp_t *tcp_io_ctx;
@@ -291,6 +346,7 @@ static int _tcp_connect(network_context_t *ctx)
             return -1;
         }
 
+        _tcp_nodelay(GET_SOCKET(ctx));
         tcp_io_ctx->connected = TRUE;
     }
     PTHREAD_CALL(pthread_mutex_unlock(&tcp_io_ctx->connect_lock));
@@ -298,3 +354,19 @@ static int _tcp_connect(network_context_t *ctx)
     return 0;
 }
 
+/* each packet should reach the peer as soon as it is written, as a
+ * datagram would; with Nagle's algorithm, a small packet waits for the
+ * TCP ACK of the one before it, which delays segments (and the ACKs
+ * STCP takes its RTT samples from) by as much as the peer's delayed ACK
+ * timer
+ */
+static void _tcp_nodelay(socket_t tcp_sd)
+{
+    int on = 1;
+
+    if (setsockopt(tcp_sd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+    {
+        DEBUG_LOG(("couldn't set TCP_NODELAY (errno=%d)\n", errno));
+    }
+}
+
@@ -0,0 +1,140 @@
+/* reassembly.c--out-of-order receive buffer for the transport layer.
+ *
+ * segments that arrive ahead of the next expected sequence number are
+ * folded into intervals of contiguous data.  an arrival that extends an
+ * interval grows its buffer in place, so a long run behind a single hole
+ * costs one copy per byte; when the hole fills, transport.c hands each
+ * interval that has become in-order to the application in one piece.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "transport.h"
+#include "reassembly.h"
+
+
+static void reserve(reasm_interval_t *iv, size_t len);
+
+/* one past the last sequence number held, wrapped like any other */
+static inline tcp_seq interval_end(const reasm_interval_t *iv)
+{
+    return iv->seq + (tcp_seq)iv->len;
+}
+
+
+bool_t reasm_insert(reasm_queue_t *q, tcp_seq seq, const char *data, size_t len)
+{
+    reasm_interval_t **pos = &q->head;
+    reasm_interval_t *iv, *next;
+    tcp_seq end = seq + len;
+    size_t held;
+
+    assert(q && data);
+    if (!len)
+        return false;
+    q->recent = seq;
+
+    //Skip intervals that end before this one starts (touching counts)
+    while (*pos && SEQ_LT(interval_end(*pos), seq))
+        pos = &(*pos)->next;
+
+    //Nothing to merge with: a new interval
+    if (!*pos || SEQ_GT((*pos)->seq, end)){
+        iv = (reasm_interval_t *)calloc(1, sizeof(reasm_interval_t));
+        assert(iv);
+        iv->seq = seq;
+        reserve(iv, len);
+        memcpy(iv->data, data, len);
+        iv->len = len;
+        iv->next = *pos;
+        *pos = iv;
+        q->bytes += len;
+        return true;
+    }
+
+    iv = *pos;
+    held = q->bytes;
+
+    //Extends the interval to the left: rebuild it with the new bytes first
+    if (SEQ_LT(seq, iv->seq)){
+        size_t front = iv->seq - seq;
+        char *old = iv->data;
+
+        iv->data = NULL;
+        iv->cap = 0;
+        reserve(iv, front + iv->len);
+        memcpy(iv->data, data, front);
+        memcpy(iv->data + front, old, iv->len);
+        free(old);
+        iv->seq = seq;
+        iv->len += front;
+        q->bytes += front;
+    }
+
+    //Extends it to the right, possibly swallowing the intervals that follow
+    if (SEQ_GT(end, interval_end(iv))){
+        size_t skip = interval_end(iv) - seq;
+
+        reserve(iv, end - iv->seq);
+        memcpy(iv->data + iv->len, data + skip, len - skip);
+        iv->len += len - skip;
+        q->bytes += len - skip;
+
+        while ((next = iv->next) && SEQ_LEQ(next->seq, interval_end(iv))){
+            tcp_seq next_end = interval_end(next);
+
+            //The part of next we already had counts once
+            q->bytes -= std::min(next->len, (size_t)(interval_end(iv) - next->seq));
+            if (SEQ_GT(next_end, interval_end(iv))){
+                size_t tail = next_end - interval_end(iv);
+                reserve(iv, iv->len + tail);
+                memcpy(iv->data + iv->len, next->data + next->len - tail, tail);
+                iv->len += tail;
+            }
+            iv->next = next->next;
+            free(next->data);
+            free(next);
+        }
+    }
+
+    return q->bytes != held;
+}
+
+void reasm_pop(reasm_queue_t *q)
+{
+    reasm_interval_t *iv = q->head;
+
+    assert(iv);
+    q->head = iv->next;
+    q->bytes -= iv->len;
+    free(iv->data);
+    free(iv);
+}
+
+const reasm_interval_t *reasm_recent(const reasm_queue_t *q)
+{
+    for (reasm_interval_t *iv = q->head; iv; iv = iv->next)
+        if (SEQ_GEQ(q->recent, iv->seq) && SEQ_LT(q->recent, interval_end(iv)))
+            return iv;
+    return NULL;
+}
+
+void reasm_free(reasm_queue_t *q)
+{
+    while (q->head)
+        reasm_pop(q);
+}
+
+/* make room for len bytes in an interval, growing geometrically so that
+ * repeated appends stay linear
+ */
+static void reserve(reasm_interval_t *iv, size_t len)
+{
+    if (len <= iv->cap)
+        return;
+    iv->cap = std::max(len, 2 * iv->cap);
+    iv->data = (char *)realloc(iv->data, iv->cap);
+    assert(iv->data);
+}
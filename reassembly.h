@@ -0,0 +1,43 @@
+/* reassembly.h--out-of-order receive buffer for the transport layer.
+ * this is an internal header, used only by transport.c.
+ */
+
+#ifndef __REASSEMBLY_H__
+#define __REASSEMBLY_H__
+
+#include "transport.h"
+
+
+/* a run of contiguous sequence space received ahead of recv_next_seq */
+typedef struct reasm_interval
+{
+    tcp_seq  seq;               /* first sequence number held */
+    size_t   len;               /* bytes held */
+    size_t   cap;               /* bytes allocated for data */
+    char    *data;
+    struct reasm_interval *next;
+} reasm_interval_t;
+
+/* held data, as disjoint, non-adjacent intervals in sequence order */
+typedef struct
+{
+    reasm_interval_t *head;
+    size_t   bytes;             /* total bytes held */
+    tcp_seq  recent;            /* start of the most recent arrival */
+} reasm_queue_t;
+
+
+/* hold len bytes starting at seq, merging them with any intervals they
+ * overlap or touch.  returns TRUE if any of the bytes were not already held.
+ */
+bool_t reasm_insert(reasm_queue_t *q, tcp_seq seq, const char *data, size_t len);
+
+/* drop the first interval, once the caller has consumed it */
+void reasm_pop(reasm_queue_t *q);
+
+/* the interval holding the most recent arrival, or NULL */
+const reasm_interval_t *reasm_recent(const reasm_queue_t *q);
+
+void reasm_free(reasm_queue_t *q);
+
+#endif  /* __REASSEMBLY_H__ */
@@ -0,0 +1,91 @@
+/* sendbuf.c--send buffer for the transport layer.
+ *
+ * app data is written once, into a power-of-two ring whose offsets are
+ * sequence numbers masked by the size.  a cumulative ACK just moves the
+ * start of the ring forward, and segments are sent by handing the network
+ * layer the slices of the ring they cover, so nothing is copied again
+ * until the packet is put together for the wire.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "transport.h"
+#include "sendbuf.h"
+
+
+/* offset of seq within the ring */
+static inline uint32_t ring_offset(const sendbuf_t *sb, tcp_seq seq)
+{
+    return seq & (sb->size - 1);
+}
+
+
+void sendbuf_init(sendbuf_t *sb, uint32_t size, tcp_seq una)
+{
+    assert(sb && size && !(size & (size - 1)));
+
+    sb->data = (char *)malloc(size);
+    assert(sb->data);
+    sb->size = size;
+    sb->una = una;
+    sb->len = 0;
+}
+
+char *sendbuf_tail(const sendbuf_t *sb, size_t *len)
+{
+    uint32_t start = ring_offset(sb, sb->una + sb->len);
+
+    assert(sb && len);
+    *len = std::min(sb->size - sb->len, sb->size - start);
+    return sb->data + start;
+}
+
+void sendbuf_commit(sendbuf_t *sb, size_t len)
+{
+    assert(sb && len <= sb->size - sb->len);
+    sb->len += len;
+}
+
+void sendbuf_trim(sendbuf_t *sb, tcp_seq ack)
+{
+    tcp_seq end = sb->una + sb->len;
+
+    assert(sb);
+    //An ACK may also cover a FIN, which takes no space here
+    if (SEQ_GT(ack, end))
+        ack = end;
+    if (SEQ_GT(ack, sb->una)){
+        sb->len -= ack - sb->una;
+        sb->una = ack;
+    }
+}
+
+int sendbuf_peek(const sendbuf_t *sb, tcp_seq seq, size_t len,
+                 sendbuf_slice_t slices[2])
+{
+    uint32_t start = ring_offset(sb, seq);
+    size_t first;
+
+    assert(sb && slices);
+    assert(SEQ_GEQ(seq, sb->una) &&
+           SEQ_LEQ(seq + (tcp_seq)len, sb->una + sb->len));
+
+    first = std::min(len, (size_t)(sb->size - start));
+    slices[0].data = sb->data + start;
+    slices[0].len = first;
+    if (first == len)
+        return 1;
+
+    slices[1].data = sb->data;
+    slices[1].len = len - first;
+    return 2;
+}
+
+void sendbuf_free(sendbuf_t *sb)
+{
+    assert(sb);
+    free(sb->data);
+    sb->data = NULL;
+    sb->size = sb->len = 0;
+}
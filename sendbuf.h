@@ -0,0 +1,54 @@
+/* sendbuf.h--send buffer for the transport layer.
+ * this is an internal header, used only by transport.c.
+ */
+
+#ifndef __SENDBUF_H__
+#define __SENDBUF_H__
+
+#include "transport.h"
+
+
+/* app data from the oldest unacknowledged byte to the newest byte the app
+ * has written, in a ring indexed by sequence number.  segments, including
+ * retransmissions, are sent straight out of it.
+ */
+typedef struct
+{
+    char    *data;
+    uint32_t size;              /* capacity in bytes, a power of two */
+    tcp_seq  una;               /* sequence number of the first byte held */
+    uint32_t len;               /* bytes held */
+} sendbuf_t;
+
+/* a piece of the buffer; a range that wraps around the end is two */
+typedef struct
+{
+    const char *data;
+    size_t      len;
+} sendbuf_slice_t;
+
+
+/* set up sb to hold at most size bytes (a power of two), starting at
+ * sequence number una
+ */
+void sendbuf_init(sendbuf_t *sb, uint32_t size, tcp_seq una);
+
+/* the free space after the newest byte, up to the end of the ring.  the
+ * caller fills up to *len bytes there and passes the count to
+ * sendbuf_commit().
+ */
+char *sendbuf_tail(const sendbuf_t *sb, size_t *len);
+void sendbuf_commit(sendbuf_t *sb, size_t len);
+
+/* forget everything before ack */
+void sendbuf_trim(sendbuf_t *sb, tcp_seq ack);
+
+/* the len bytes starting at seq, which must be held, as one or two
+ * slices.  returns the number of slices.
+ */
+int sendbuf_peek(const sendbuf_t *sb, tcp_seq seq, size_t len,
+                 sendbuf_slice_t slices[2]);
+
+void sendbuf_free(sendbuf_t *sb);
+
+#endif  /* __SENDBUF_H__ */
@@ -26,7 +26,7 @@
 
 
 
-static char usage[] = "usage: %s \n";
+static char usage[] = "usage: %s [-j] [-c reno|cubic|bbr|ledbat] [-r <bytes/sec>]\n";
 
 static void do_connection(mysocket_t bindsd);
 static int get_nvt_line(int sd, char *);
@@ -40,14 +40,28 @@ main(int argc, char *argv[])
     struct sockaddr_in sin;
     mysocket_t bindsd;
     int len, opt, errflg = 0;
+    int congestion = -1;
+    unsigned int max_rate = 0;
+    int jumbo = 0;
     char localname[256];
 
 
     /* Parse the command line */
-    while ((opt = getopt(argc, argv, "")) != EOF)
+    while ((opt = getopt(argc, argv, "jc:r:")) != EOF)
     {
         switch (opt)
         {
+        case 'c':
+            if ((congestion = mycongestion(optarg)) < 0)
+                ++errflg;
+            break;
+        case 'r':
+            if (sscanf(optarg, "%u", &max_rate) != 1)
+                ++errflg;
+            break;
+        case 'j':
+            jumbo = 1;
+            break;
         case '?':
             ++errflg;
             break;
@@ -67,6 +81,30 @@ main(int argc, char *argv[])
         exit(EXIT_FAILURE);
     }
 
+    /* accepted connections inherit the listening socket's options */
+    if (congestion >= 0 &&
+        mysetsockopt(bindsd, MYSOCK_OPT_CONGESTION,
+                     &congestion, sizeof(congestion)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    if (max_rate > 0 &&
+        mysetsockopt(bindsd, MYSOCK_OPT_MAX_RATE,
+                     &max_rate, sizeof(max_rate)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    if (jumbo &&
+        mysetsockopt(bindsd, MYSOCK_OPT_JUMBO, &jumbo, sizeof(jumbo)) < 0)
+    {
+        perror("mysetsockopt");
+        exit(EXIT_FAILURE);
+    }
+
     memset(&sin, 0, sizeof(sin));
     sin.sin_family = AF_INET;
     sin.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -99,7 +137,12 @@ main(int argc, char *argv[])
         /* just keep accepting connections forever */
         if ((sd = myaccept(bindsd, (struct sockaddr *) &sin, &len)) < 0)
         {
+            int err = errno;
+
             perror("myaccept");
+            /* a client that went away mid-handshake only costs us that one */
+            if (err == ETIMEDOUT || err == ECONNREFUSED || err == ECONNABORTED)
+                continue;
             exit(EXIT_FAILURE);
         }
 
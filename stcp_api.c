@@ -13,6 +13,7 @@
 #include "network.h"
 #include "connection_demux.h"
 #include "tcp_sum.h"
+#include "timer_wheel.h"
 #include "transport.h"
 
 
@@ -67,6 +68,7 @@ unsigned int stcp_wait_for_event(mysocket_t             sd,
     mysock_context_t *ctx = _mysock_get_context(sd);
 
     PTHREAD_CALL(pthread_mutex_lock(&ctx->data_ready_lock));
+    ctx->stcp_wait_flags = flags;
     for (;;)
     {
         if ((flags & APP_DATA) && (ctx->app_recv_queue.head != NULL))
@@ -75,6 +77,18 @@ unsigned int stcp_wait_for_event(mysocket_t             sd,
         if ((flags & NETWORK_DATA) && (ctx->network_recv_queue.head != NULL))
             rc |= NETWORK_DATA;
 
+        if ((flags & TIMER_EXPIRED) && ctx->timers_fired)
+        {
+            ctx->timers_fired = 0;
+            rc |= TIMER_EXPIRED;
+        }
+
+        if ((flags & APP_DATA_READ) && ctx->app_read)
+        {
+            ctx->app_read = FALSE;
+            rc |= APP_DATA_READ;
+        }
+
         if (/*(flags & APP_CLOSE_REQUESTED) &&*/
             ctx->close_requested && (ctx->app_recv_queue.head == NULL))
         {
@@ -121,11 +135,36 @@ unsigned int stcp_wait_for_event(mysocket_t             sd,
     }
 
 done:
+    ctx->stcp_wait_flags = 0;
     PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
 
     return rc;
 }
 
+/* connection timers; see stcp_api.h.  _mysock_timer_expired() wakes the
+ * transport thread when one fires.
+ */
+uint64_t stcp_now(void)
+{
+    return _timer_now();
+}
+
+void stcp_set_timer(mysocket_t sd, int timer, uint64_t expire)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+
+    assert(ctx && timer >= 0 && timer < STCP_MAX_TIMERS);
+    _timer_set(&ctx->timers[timer], expire);
+}
+
+void stcp_cancel_timer(mysocket_t sd, int timer)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+
+    assert(ctx && timer >= 0 && timer < STCP_MAX_TIMERS);
+    _timer_cancel(&ctx->timers[timer]);
+}
+
 /* allow STCP implementation to establish a context for a given mysocket
  * descriptor.  this context should contain any information that needs to be
  * tracked for the given mysocket, e.g. sequence numbers, retransmission
@@ -144,6 +183,46 @@ void *stcp_get_context(mysocket_t sd)
     return ctx->stcp_state;
 }
 
+/* congestion control algorithm requested via mysetsockopt() */
+int stcp_get_congestion_control(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    assert(ctx);
+    return ctx->congestion_control;
+}
+
+/* acknowledgement policy requested via mysetsockopt() */
+int stcp_get_ack_mode(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    assert(ctx);
+    return ctx->ack_mode;
+}
+
+/* whether small writes are sent without coalescing, via mysetsockopt() */
+bool_t stcp_get_nodelay(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    assert(ctx);
+    return ctx->nodelay;
+}
+
+/* pacing rate cap set via mysetsockopt(), 0 if none */
+unsigned int stcp_get_max_rate(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    assert(ctx);
+    return ctx->max_rate;
+}
+
+/* largest datagram the network layer carries for this mysocket */
+size_t stcp_network_max_datagram(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    assert(ctx);
+    return _network_max_datagram(&ctx->network_state);
+}
+
 /* stcp_network_recv
  *
  * Receive a datagram from the peer.  The call blocks until data is
@@ -188,7 +267,7 @@ ssize_t stcp_network_recv(mysocket_t sd, void *dst, size_t max_len)
 ssize_t stcp_network_send(mysocket_t sd, const void *src, size_t src_len, ...)
 {
     mysock_context_t *ctx = _mysock_get_context(sd);
-    char              packet[MAX_IP_PAYLOAD_LEN];
+    char              packet[MAX_JUMBO_PAYLOAD_LEN];
     size_t            packet_len;
     const void       *next_buf;
     va_list           argptr;
@@ -259,6 +338,18 @@ void stcp_app_send(mysocket_t sd, const void *src, size_t src_len)
     }
 }
 
+size_t stcp_app_unread(mysocket_t sd)
+{
+    mysock_context_t *ctx = _mysock_get_context(sd);
+    size_t unread;
+
+    assert(ctx);
+    PTHREAD_CALL(pthread_mutex_lock(&ctx->data_ready_lock));
+    unread = ctx->app_send_queue.bytes;
+    PTHREAD_CALL(pthread_mutex_unlock(&ctx->data_ready_lock));
+    return unread;
+}
+
 void stcp_fin_received(mysocket_t sd)
 {
     mysock_context_t *ctx = _mysock_get_context(sd);
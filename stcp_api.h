@@ -17,9 +17,14 @@ typedef enum
     APP_DATA            = 1,
     NETWORK_DATA        = 2,
     APP_CLOSE_REQUESTED = 4,
+    TIMER_EXPIRED       = 8,
+    APP_DATA_READ       = 16,
     ANY_EVENT           = APP_DATA | NETWORK_DATA | APP_CLOSE_REQUESTED
 } stcp_event_type_t;
 
+/* number of timers each connection may have running at once */
+#define STCP_MAX_TIMERS 8
+
 
 /* called by the transport layer thread to unblock the calling application,
  * e.g. when the connection is established, or when an error is detected
@@ -61,6 +66,19 @@ unsigned int stcp_wait_for_event(mysocket_t             sd,
                                  unsigned int           wait_flags,
                                  const struct timespec *abstime);
 
+/* connection timers.  each connection has STCP_MAX_TIMERS of them, numbered
+ * from 0, kept on a timer wheel shared by all connections.  expiry times
+ * are in microseconds on the clock returned by stcp_now(), which is
+ * monotonic; a timer may fire up to 1/32 of its timeout late, so that
+ * timers due at about the same time share a wakeup.  when any of a
+ * connection's timers fires, stcp_wait_for_event() returns TIMER_EXPIRED
+ * (if it was asked for), alone or along with other events.  setting a
+ * timer that is already running moves it.
+ */
+uint64_t stcp_now(void);
+void stcp_set_timer(mysocket_t sd, int timer, uint64_t expire);
+void stcp_cancel_timer(mysocket_t sd, int timer);
+
 /* allow STCP implementation to establish a context for a given mysocket
  * descriptor.  this context should contain any information that needs to be
  * tracked for the given mysocket, e.g. sequence numbers, retransmission
@@ -71,6 +89,31 @@ unsigned int stcp_wait_for_event(mysocket_t             sd,
 void stcp_set_context(mysocket_t sd, const void *stcp_state);
 void *stcp_get_context(mysocket_t my_sd);
 
+/* returns the congestion control algorithm the application selected for
+ * this connection with mysetsockopt() (one of the MYSOCK_CC_* values).
+ */
+int stcp_get_congestion_control(mysocket_t sd);
+
+/* returns the acknowledgement policy the application selected for this
+ * connection with mysetsockopt() (one of the MYSOCK_ACK_* values).
+ */
+int stcp_get_ack_mode(mysocket_t sd);
+
+/* returns TRUE if the application disabled Nagle's algorithm for this
+ * connection with mysetsockopt().
+ */
+bool_t stcp_get_nodelay(mysocket_t sd);
+
+/* returns the most (bytes/sec) the application allowed this connection to
+ * send with mysetsockopt(), or 0 if it set no limit.
+ */
+unsigned int stcp_get_max_rate(mysocket_t sd);
+
+/* returns the size in bytes of the largest datagram, STCP header included,
+ * that stcp_network_send() can deliver to the peer.
+ */
+size_t stcp_network_max_datagram(mysocket_t sd);
+
 /* Receive a datagram from the peer.
  *
  * sd       Mysocket descriptor.
@@ -104,6 +147,13 @@ size_t stcp_app_recv(mysocket_t sd, void *dst, size_t max_len);
 /* pass data up to the application for consumption by myread() */
 void stcp_app_send(mysocket_t sd, const void *src, size_t src_len);
 
+/* bytes passed up with stcp_app_send() that the application has not yet
+ * read.  after each myread() that consumes data, stcp_wait_for_event()
+ * returns APP_DATA_READ (if it was asked for), so that STCP can offer the
+ * peer the space that was freed.
+ */
+size_t stcp_app_unread(mysocket_t sd);
+
 /* once you receive a FIN segment from the peer, we need to let the
  * application know there's no more data arriving (by returning 0 bytes for
  * subsequent myread() calls).  call stcp_fin_received() to indicate the
@@ -29,7 +29,7 @@ uint16_t _mysock_tcp_checksum(uint32_t src_addr /*network byte order*/,
     };
 
     unsigned int k;
-    int32_t sum = 0;
+    uint32_t sum = 0;   /* a super-frame's worth of words can't overflow it */
 
     assert(packet && len >= sizeof(struct tcphdr));
     assert(sizeof(pseudo_header) == 12);
@@ -0,0 +1,299 @@
+/* timer_wheel.c--shared timer service for the mysocket layer.
+ *
+ * every connection's timers live on one hierarchical timing wheel, run by
+ * a single thread on the monotonic clock.  level 0 has a slot per tick for
+ * the next WHEEL_SIZE ticks; each level above covers WHEEL_SIZE times the
+ * span of the one below, a slot per WHEEL_SIZE ticks of that level.  a
+ * slot on a higher level is cascaded down when the wheel reaches its start,
+ * so arming and cancelling are O(1) and a tick costs O(1) amortised.  the
+ * thread sleeps until the next slot with anything in it, and timers are
+ * rounded up a little (see apply_slack()) so that they share wakeups.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include "mysock_impl.h"
+#include "timer_wheel.h"
+
+
+#define WHEEL_TICK_US   1000            /* resolution of the wheel */
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4               /* 2^24 ticks, about 4.6 hours */
+#define WHEEL_SPAN      ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+/* a timer may fire up to 1/2^WHEEL_SLACK_SHIFT of its timeout late */
+#define WHEEL_SLACK_SHIFT 5
+
+#define LEVEL_SHIFT(level) (WHEEL_BITS * (level))
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       /* wakes the timer thread early */
+    wheel_timer_t  *slots[WHEEL_LEVELS][WHEEL_SIZE];
+    uint64_t        now;        /* next tick to process */
+    uint64_t        wakeup;     /* tick the thread sleeps until, 0 if none */
+    unsigned int    count;      /* timers on the wheel */
+} wheel;
+
+static pthread_once_t wheel_once = PTHREAD_ONCE_INIT;
+
+static void wheel_init(void);
+static void *wheel_thread_func(void *arg);
+static void wheel_insert(wheel_timer_t *timer);
+static void wheel_unlink(wheel_timer_t *timer);
+static void wheel_step(void);
+static uint64_t wheel_next_due(void);
+static uint64_t apply_slack(uint64_t expire, uint64_t current);
+
+
+uint64_t _timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void _timer_init(wheel_timer_t *timer, timer_callback_t fn, void *arg)
+{
+    assert(timer && fn);
+
+    memset(timer, 0, sizeof(*timer));
+    timer->fn  = fn;
+    timer->arg = arg;
+}
+
+void _timer_set(wheel_timer_t *timer, uint64_t expire)
+{
+    uint64_t current = _timer_now() / WHEEL_TICK_US;
+
+    assert(timer && timer->fn);
+    PTHREAD_CALL(pthread_once(&wheel_once, wheel_init));
+
+    PTHREAD_CALL(pthread_mutex_lock(&wheel.lock));
+    if (timer->pending)
+        wheel_unlink(timer);
+
+    /* an empty wheel may have been left behind while the thread slept */
+    if (!wheel.count && wheel.now < current)
+        wheel.now = current;
+
+    /* round up to the tick, so a timer never fires early */
+    timer->expire = apply_slack((expire + WHEEL_TICK_US - 1) / WHEEL_TICK_US,
+                                current);
+    wheel_insert(timer);
+
+    /* the thread only needs to hear about timers due before it wakes */
+    if (!wheel.wakeup || timer->expire < wheel.wakeup)
+        PTHREAD_CALL(pthread_cond_signal(&wheel.cond));
+    PTHREAD_CALL(pthread_mutex_unlock(&wheel.lock));
+}
+
+void _timer_cancel(wheel_timer_t *timer)
+{
+    assert(timer);
+    if (!timer->fn)
+        return;     /* never initialised */
+
+    PTHREAD_CALL(pthread_once(&wheel_once, wheel_init));
+    PTHREAD_CALL(pthread_mutex_lock(&wheel.lock));
+    if (timer->pending)
+        wheel_unlink(timer);
+    PTHREAD_CALL(pthread_mutex_unlock(&wheel.lock));
+}
+
+
+static void wheel_init(void)
+{
+    pthread_condattr_t attr;
+
+    PTHREAD_CALL(pthread_mutex_init(&wheel.lock, NULL));
+    PTHREAD_CALL(pthread_condattr_init(&attr));
+    PTHREAD_CALL(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC));
+    PTHREAD_CALL(pthread_cond_init(&wheel.cond, &attr));
+    PTHREAD_CALL(pthread_condattr_destroy(&attr));
+
+    wheel.now = _timer_now() / WHEEL_TICK_US;
+    (void) _mysock_create_thread(wheel_thread_func, NULL, TRUE);
+}
+
+/* the timer thread: fire whatever is due, then sleep until the next slot
+ * that holds a timer, or until a new timer is due before that
+ */
+static void *wheel_thread_func(void *arg)
+{
+    (void) arg;
+
+    PTHREAD_CALL(pthread_mutex_lock(&wheel.lock));
+    for (;;)
+    {
+        uint64_t current = _timer_now() / WHEEL_TICK_US;
+
+        while (wheel.now <= current)
+            wheel_step();
+
+        if (!wheel.count)
+        {
+            wheel.wakeup = 0;
+            PTHREAD_CALL(pthread_cond_wait(&wheel.cond, &wheel.lock));
+        }
+        else
+        {
+            struct timespec abstime;
+            int rc;
+
+            wheel.wakeup = wheel_next_due();
+            abstime.tv_sec  = wheel.wakeup * WHEEL_TICK_US / 1000000;
+            abstime.tv_nsec = (wheel.wakeup * WHEEL_TICK_US % 1000000) * 1000;
+
+            rc = pthread_cond_timedwait(&wheel.cond, &wheel.lock, &abstime);
+            assert(rc == 0 || rc == ETIMEDOUT || rc == EINTR);
+        }
+    }
+
+    /*NOTREACHED*/
+    PTHREAD_CALL(pthread_mutex_unlock(&wheel.lock));
+    return NULL;
+}
+
+/* put a timer in the slot for its expiry, relative to wheel.now */
+static void wheel_insert(wheel_timer_t *timer)
+{
+    wheel_timer_t **slot;
+    uint64_t delta;
+    int level;
+
+    if (timer->expire < wheel.now)
+        timer->expire = wheel.now;
+    if (timer->expire - wheel.now >= WHEEL_SPAN)
+        timer->expire = wheel.now + WHEEL_SPAN - 1;
+    delta = timer->expire - wheel.now;
+
+    for (level = 0; level < WHEEL_LEVELS - 1; ++level)
+    {
+        if (delta < ((uint64_t) 1 << LEVEL_SHIFT(level + 1)))
+            break;
+    }
+
+    slot = &wheel.slots[level]
+                       [(timer->expire >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+
+    timer->pending = TRUE;
+    ++wheel.count;
+}
+
+static void wheel_unlink(wheel_timer_t *timer)
+{
+    assert(timer->pending && wheel.count > 0);
+
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next    = NULL;
+    timer->pprev   = NULL;
+    timer->pending = FALSE;
+    --wheel.count;
+}
+
+/* process tick wheel.now: cascade any higher level slot that starts here,
+ * then fire everything in the level 0 slot
+ */
+static void wheel_step(void)
+{
+    wheel_timer_t *timer;
+    int level;
+
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        wheel_timer_t **slot;
+
+        if (wheel.now & (((uint64_t) 1 << LEVEL_SHIFT(level)) - 1))
+            break;
+
+        slot = &wheel.slots[level]
+                           [(wheel.now >> LEVEL_SHIFT(level)) & WHEEL_MASK];
+        while ((timer = *slot) != NULL)
+        {
+            wheel_unlink(timer);
+            wheel_insert(timer);
+        }
+    }
+
+    while ((timer = wheel.slots[0][wheel.now & WHEEL_MASK]) != NULL)
+    {
+        wheel_unlink(timer);
+        timer->fn(timer);
+    }
+
+    ++wheel.now;
+}
+
+/* the first tick at which wheel_step() will have something to do: the
+ * earliest non-empty level 0 slot, or the start of the earliest non-empty
+ * slot on a higher level, whichever comes first
+ */
+static uint64_t wheel_next_due(void)
+{
+    uint64_t next = wheel.now + WHEEL_SPAN;
+    int level, i;
+
+    for (i = 0; i < WHEEL_SIZE; ++i)
+    {
+        if (wheel.slots[0][(wheel.now + i) & WHEEL_MASK])
+            return wheel.now + i;
+    }
+
+    for (level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        uint64_t base = wheel.now >> LEVEL_SHIFT(level);
+
+        /* the current slot, once cascaded, holds timers a whole turn of
+         * this level away, so it is looked at again as the last one
+         */
+        for (i = 0; i <= WHEEL_SIZE; ++i)
+        {
+            uint64_t start = (base + i) << LEVEL_SHIFT(level);
+
+            if (start < wheel.now)
+                continue;   /* already cascaded */
+            if (wheel.slots[level][(base + i) & WHEEL_MASK])
+            {
+                next = MIN(next, start);
+                break;
+            }
+        }
+    }
+
+    return next;
+}
+
+/* let a timer fire up to 1/2^WHEEL_SLACK_SHIFT of its timeout late, by
+ * rounding its expiry up to a multiple of the largest power of two ticks
+ * that allows.  timers with similar timeouts then land on the same tick.
+ */
+static uint64_t apply_slack(uint64_t expire, uint64_t current)
+{
+    uint64_t slack, unit;
+
+    if (expire <= current)
+        return expire;
+
+    slack = (expire - current) >> WHEEL_SLACK_SHIFT;
+    for (unit = 1; unit * 2 <= slack; unit *= 2)
+        ;
+
+    return (expire + unit - 1) & ~(unit - 1);
+}
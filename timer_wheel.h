@@ -0,0 +1,43 @@
+/* timer_wheel.h--shared timer service for the mysocket layer.
+ * this is an internal header, used only by the mysocket layer.
+ */
+
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "mysock.h"
+
+struct wheel_timer;
+
+/* called on the timer thread, with the wheel locked, when a timer expires.
+ * it must be quick and must not set or cancel timers.
+ */
+typedef void (*timer_callback_t)(struct wheel_timer *timer);
+
+/* a timer, embedded in whatever owns it; the wheel never allocates */
+typedef struct wheel_timer
+{
+    timer_callback_t     fn;
+    void                *arg;       /* for the callback's use */
+    uint64_t             expire;    /* tick at which it fires */
+    bool_t               pending;   /* on the wheel */
+    struct wheel_timer  *next;
+    struct wheel_timer **pprev;     /* the pointer that points at us */
+} wheel_timer_t;
+
+
+/* microseconds on the monotonic clock the wheel runs on */
+uint64_t _timer_now(void);
+
+void _timer_init(wheel_timer_t *timer, timer_callback_t fn, void *arg);
+
+/* (re)arm timer to fire at expire (usec, from _timer_now()).  a timer may
+ * be delayed by up to 1/32 of its timeout, so that timers due at about
+ * the same time fire together.
+ */
+void _timer_set(wheel_timer_t *timer, uint64_t expire);
+
+void _timer_cancel(wheel_timer_t *timer);
+
+#endif  /* __TIMER_WHEEL_H__ */
+
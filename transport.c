@@ -15,40 +15,303 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <algorithm>
 #include "mysock.h"
 #include "stcp_api.h"
 #include "transport.h"
+#include "congestion.h"
+#include "reassembly.h"
+#include "sendbuf.h"
 
-#define bit_win 3072
+/* receive window we offer; scaled down into th_win once the peer agrees
+ * to window scaling, and capped at 65535 bytes otherwise.  the receive
+ * buffer starts at RECV_BUF_INITIAL and auto-tuning grows it towards the
+ * bandwidth-delay product, up to RECV_WIN_MAX.
+ */
+#define RECV_WIN_MAX (1 << 20)
+#define RECV_BUF_INITIAL (64 * 1024)
+
+/* app data we hold, sent or not, until the peer acknowledges it; a power
+ * of two, and so also the most we can have in flight
+ */
+#define SEND_BUF_SIZE (1 << 20)
+
+/* retransmission timer parameters, in microseconds */
+#define RTO_INITIAL   1000000
+#define RTO_MIN       200000
+#define RTO_MAX       60000000
+#define CLOCK_GRANULARITY 1000
+#define MAX_RETRANSMITS 8      //give up on the peer after this many timeouts
+#define SYN_RETRIES   5        //resends of an unanswered SYN or SYN-ACK
+
+/* zero window probes: the interval starts at the RTO and doubles with each
+ * unanswered probe, up to RTO_MAX; probing never gives up on the peer
+ */
+#define PERSIST_MAX_BACKOFF 16
+
+/* a hole is presumed lost once this many segments above it are SACKed */
+#define DUP_THRESH 3
+
+/* delayed ACKs (RFC 1122, RFC 5681): ACK every second in-order segment, or
+ * once the oldest unacknowledged one has waited DELACK_TIMEOUT usec.  the
+ * adaptive mode acknowledges up to ACK_EVERY_MAX segments at once when the
+ * data arrives fast enough that the timer won't have to fire.
+ */
+#define DELACK_TIMEOUT 40000
+#define ACK_EVERY      2
+#define ACK_EVERY_MAX  8
+
+/* RACK-TLP (RFC 8985): a segment is lost once one sent after it has been
+ * delivered and it has been outstanding for an RTT plus the reordering
+ * window; a tail loss probe goes out after two SRTTs of silence
+ */
+#define RACK_REO_WND(min_rtt) ((min_rtt) / 4)
+#define TLP_PTO(srtt)         (2 * (srtt) + DELACK_TIMEOUT)
+
+/* timestamps (RFC 7323): TSval ticks every TS_TICK_US, and the last
+ * timestamp we took from the peer is no longer trusted for PAWS once the
+ * connection has been idle for PAWS_IDLE (24 days, well short of the
+ * clock's wrap)
+ */
+#define TS_TICK_US 1000
+#define PAWS_IDLE  ((uint64_t)24 * 24 * 60 * 60 * 1000000)
+
+/* pacing: data leaves at the congestion control's pacing rate, capped by
+ * MYSOCK_OPT_MAX_RATE.  credit saved while idle or while waiting for the
+ * pacing timer is capped at PACE_BURST_US worth (two segments at least),
+ * enough to make up for the timer wheel's millisecond ticks
+ */
+#define PACE_BURST_US 2000
+
+/* largest datagram any network layer hands us: a super-frame from the
+ * TCP backend in jumbo mode (see stcp_network_max_datagram())
+ */
+#define MAX_PACKET_LEN 65535
+
+/* start a group of context_t fields on its own cache line */
+#define CACHE_LINE_SIZE 64
+#define CACHE_ALIGNED __attribute__ ((aligned (CACHE_LINE_SIZE)))
 
 enum { CSTATE_ESTABLISHED, CSTATE_HANDSHAKING, CSTATE_CLOSING, CSTATE_CLOSED };    /* you should have more states */
 
-/* this structure is global to a mysocket descriptor */
+/* our timers on the mysock layer's timer wheel (stcp_set_timer()) */
+enum { TIMER_RTO, TIMER_DELACK, TIMER_RACK, TIMER_TLP, TIMER_PERSIST, TIMER_PACE,
+       NUM_TIMERS };
+
+/* a segment we have sent but the peer has not yet acknowledged */
+typedef struct retx_segment
+{
+    tcp_seq  seq;           //first sequence number of the segment
+    size_t   seq_len;       //sequence space used: payload, +1 for a FIN
+    uint8_t  flags;
+    size_t   data_len;      //payload, held in the send buffer at seq
+    uint64_t sent_time;     //when the segment was last sent (usec)
+    bool_t   retransmitted; //Karn's rule: never sample RTT from these
+    bool_t   sacked;        //the peer holds this segment out of order
+    bool_t   lost;          //presumed lost and waiting to be resent
+
+    /* delivery rate sampling: connection state when this was sent */
+    uint64_t delivered;       //bytes delivered to the peer so far
+    uint64_t delivered_time;  //when that count was last bumped
+    uint64_t first_sent_time; //send time of the first segment in this flight
+    bool_t   app_limited;     //sent while the app had nothing more for us
+    struct retx_segment *next;
+} retx_segment_t;
+
+/* retransmission queue, kept in sequence order */
 typedef struct
 {
-    bool_t done;    /*TRUE once connection is closed */
+    retx_segment_t *head;
+    retx_segment_t *tail;
+} retx_queue_t;
 
-    int connection_state;   /* state of the connection (established, etc.) */
-    tcp_seq initial_sequence_num;
-    tcp_seq curr_sequence_num; //the current number to start from when sending
+/* a range of sequence space reported in a SACK option, [left, right) */
+typedef struct
+{
+    tcp_seq left;
+    tcp_seq right;
+} sack_block_t;
+
+/* this structure is global to a mysocket descriptor.  it is allocated in
+ * one piece, with the state touched by every ACK we process and every
+ * segment we send grouped at the front and each group starting on its own
+ * cache line; recovery, timer and handshake state follow, and the packet
+ * buffers come last.  all fields are in host byte order.
+ */
+typedef struct
+{
+    /* sender: read or written for every segment sent and ACK received */
+    tcp_seq curr_sequence_num CACHE_ALIGNED; //the current number to start from when sending
+    tcp_seq last_byte_sent;   //the last byte we have sent: curr_sequence_num - 1
+    tcp_seq last_byte_ack;    //the last byte ack'd by peer: the last th_ack - 1
+    tcp_seq send_win;         //min(congestion window, their receive window)
+    tcp_seq their_recv_win;   //their receive window
+    tcp_seq max_send_win;     //largest window the peer has offered
+    uint32_t sacked_bytes;    //queued sequence space the peer has SACKed
+    uint32_t lost_bytes;      //queued sequence space presumed lost, not yet resent
+    retx_queue_t retx_queue;  //unacknowledged segments, oldest first
+    retx_segment_t *free_segs; //acknowledged segments kept for reuse
+    sendbuf_t send_buf;       //app data from snd_una on, sent or not
+    size_t pending_len;       //bytes of send_buf not sent yet
+    uint64_t rto_expire;      //absolute expiry of the retransmission timer (usec), 0 if idle
+    uint32_t rto;             //current retransmission timeout (usec)
+    uint32_t srtt;            //smoothed round-trip time (usec), 0 until first sample
+    uint32_t rttvar;          //round-trip time variation (usec)
+    int dupacks;              //duplicate ACKs since snd_una last advanced
+    bool_t in_recovery;       //repairing losses; the window has been cut
+    bool_t nodelay;           //Nagle's algorithm disabled for this connection
+    bool_t close_requested;   //the app closed; send the FIN after pending data
+    bool_t app_limited;       //the app, not the window, limited the last send
+    uint64_t delivered;       //total bytes acknowledged by the peer
+    uint64_t delivered_time;  //when delivered last changed (usec)
+    uint64_t first_sent_time; //send time of the segment that opened this flight
+    uint8_t snd_wscale;       //shift applied to windows the peer advertises
+    uint32_t mss;             //payload of a full segment: the agreed MSS less fixed options
+    uint32_t max_packet;      //largest datagram we may send the peer, header included
+    uint64_t pace_next;       //earliest departure time of the next data segment (usec)
+    uint64_t pace_expire;     //when the pacer lets data go again (usec), 0 if not waiting
+    bool_t pace_limited;      //data is waiting on the congestion control's pacing rate
+    unsigned int max_rate;    //the app's pacing cap (bytes/sec), 0 if none
+
+    /* receiver: read or written for every segment that arrives */
+    tcp_seq recv_next_seq CACHE_ALIGNED; //next in-order sequence number expected from peer
     tcp_seq last_ack_num_sent; //the last ack number we sent
+    ssize_t held_len;         //length of a segment the handshake left in recv_buffer, 0 if none
+    tcp_seq recv_win;         //our receive buffer size, auto-tuned up to RECV_WIN_MAX
+    tcp_seq recv_adv;         //right edge of the window we last advertised
+    bool_t recv_adv_set;      //recv_adv is valid
+    uint8_t rcv_wscale;       //shift applied to windows we advertise
+    uint32_t rcv_mss;         //MSS we advertised: what our datagrams can carry
+    int ack_mode;             //MYSOCK_ACK_*
+    int segs_unacked;         //in-order segments received since our last ACK
+    int ack_every;            //send an ACK once this many are waiting
+    uint64_t delack_expire;   //when a waiting ACK must go out (usec), 0 if none
+    uint64_t rate_stamp;      //adaptive: start of the current arrival count
+    int rate_segs;            //adaptive: segments that arrived since then
+    bool_t dsack_pending;     //report dsack on the next ACK
+    sack_block_t dsack;       //data the peer sent us twice
+    uint32_t ts_recent;       //timestamp to echo: the peer's TSval for our next ACK
+    uint64_t ts_recent_time;  //when ts_recent was taken (usec)
+
+    /* data from the peer that arrived ahead of recv_next_seq */
+    reasm_queue_t reasm;
+    bool_t fin_pending;       //the peer's FIN arrived ahead of its data
+    tcp_seq fin_seq;          //sequence number of that FIN
 
-    /* any other connection-wide global variables go here */
-    tcp_seq congestion_win; //Congestion window
-    tcp_seq recv_win;		  //our receive window: 3072
-    tcp_seq send_win;		  //our send window: min(congestion window, their receive window) - (last byte sent - last byte ack'd)
-    tcp_seq their_recv_win; //their receive window
-    int* last_byte_sent;    //the last byte we have sent:current sequence# -1
-    int* last_byte_ack;	  //the last byte ack'd by peer: the last th_ack -1
+    /* receive buffer auto-tuning */
+    uint32_t rcv_rtt;         //smallest time the peer took to send a window (usec)
+    uint64_t rcv_rtt_time;    //when that measurement started, 0 if none running
+    tcp_seq rcv_rtt_seq;      //and the right edge it waits for
+    uint64_t rcvq_time;       //start of the current RTT's arrival count, 0 until data
+    tcp_seq rcvq_seq;         //recv_next_seq at that time
 
-    tcphdr* hdr_buffer;
-    char* data_buffer;
+    /* RACK-TLP */
+    uint64_t rack_xmit_ts CACHE_ALIGNED; //send time of the most recently sent segment delivered
+    tcp_seq rack_end_seq;     //and the end of that segment
+    uint32_t rack_rtt;        //its round-trip time (usec)
+    uint32_t min_rtt;         //smallest RTT seen (usec), 0 until the first
+    uint64_t rack_expire;     //when a reordering-window wait ends (usec), 0 if none
+    uint64_t tlp_expire;      //when to send a tail loss probe (usec), 0 if none
+    bool_t tlp_outstanding;   //a probe is out; no more until it is answered
+    bool_t tlp_retransmitted; //the probe resent old data
+    tcp_seq tlp_high_seq;     //snd_nxt when the probe went out
+    tcp_seq recovery_point;   //recovery ends once this is cumulatively acked
+    int retransmits;          //consecutive timeouts without forward progress
+
+    /* probing a closed peer window */
+    uint64_t persist_expire;  //when to send the next window probe (usec), 0 if none
+    int persist_backoff;      //probes sent since the window closed
+
+    /* congestion control, and undoing spurious reductions (RFC 3708) */
+    congestion_t cc;          //congestion window, driven by the selected algorithm
+    congestion_t prior_cc;    //congestion state before the last reduction
+    bool_t undo_possible;     //that reduction may still be undone
+    tcp_seq undo_marker;      //snd_una when it happened
+    int undo_retrans;         //retransmissions since then not yet D-SACKed
+
+    /* connection setup and teardown */
+    bool_t done;              //TRUE once connection is closed
+    int connection_state;     //state of the connection (established, etc.)
+    tcp_seq initial_sequence_num;
+    bool_t wscale_ok;         //both sides sent a window scale option
+    bool_t sack_ok;           //both sides sent SACK-permitted
+    bool_t ts_ok;             //both sides sent timestamps
+    bool_t fin_sent;
+    bool_t fin_recv;
+    uint64_t timer_armed[NUM_TIMERS]; //expiry last given to the timer wheel, 0 if none
+
+    /* packet buffers */
+    char send_hdr[sizeof(tcphdr) + TCP_MAX_OPTIONS_LEN] CACHE_ALIGNED; //header template reused for every outgoing segment
+    char recv_buffer[MAX_PACKET_LEN] CACHE_ALIGNED; //every incoming segment, including the handshake
 } context_t;
 
 static void generate_initial_seq_num(context_t *ctx);
+static bool_t handshake(mysocket_t sd, context_t *ctx, bool_t is_active);
+static bool_t send_handshake_segment(mysocket_t sd, context_t *ctx, uint8_t flags);
+static void accept_syn(context_t *ctx, const tcphdr *hdr, size_t len);
 static void control_loop(mysocket_t sd, context_t *ctx);
+static uint64_t current_time_us(void);
+static ssize_t send_segment(mysocket_t sd, context_t *ctx, tcp_seq seq,
+                            uint8_t flags, size_t data_len);
+static void transmit_new_segment(mysocket_t sd, context_t *ctx, uint8_t flags,
+                                 size_t data_len);
+static void stamp_segment(context_t *ctx, retx_segment_t *seg, uint64_t now);
+static void handle_ack(context_t *ctx, tcp_seq ack, uint32_t tsecr);
+static void update_rtt(context_t *ctx, uint32_t rtt);
+static void handle_retransmit_timeout(mysocket_t sd, context_t *ctx);
+static void update_send_window(context_t *ctx);
+static void send_pending_data(mysocket_t sd, context_t *ctx);
+static void handle_delack_timeout(mysocket_t sd, context_t *ctx);
+static void schedule_ack(mysocket_t sd, context_t *ctx, uint64_t now);
+static retx_segment_t *alloc_segment(context_t *ctx);
+static void release_segment(context_t *ctx, retx_segment_t *seg);
+static void free_segment_list(retx_segment_t *seg);
+static uint32_t pipe_bytes(context_t *ctx);
+static void handle_sack(context_t *ctx, const sack_block_t *blocks, int num_blocks);
+static void detect_losses(context_t *ctx);
+static void handle_duplicate_ack(context_t *ctx);
+static void mark_lost(context_t *ctx, retx_segment_t *seg);
+static void enter_recovery(context_t *ctx);
+static void rack_update(context_t *ctx, const retx_segment_t *seg, uint64_t now);
+static void rack_detect_losses(context_t *ctx, uint64_t now);
+static void handle_rack_timeout(context_t *ctx);
+static void schedule_tlp(context_t *ctx, uint64_t now);
+static void handle_tlp_timeout(mysocket_t sd, context_t *ctx);
+static void send_pending_segment(mysocket_t sd, context_t *ctx, size_t len);
+static void sync_timers(mysocket_t sd, context_t *ctx);
+static uint64_t pacing_rate(context_t *ctx);
+static bool_t pacing_allows(context_t *ctx, uint64_t now);
+static void pace_segment(context_t *ctx, size_t len, uint64_t now);
+static void handle_pace_timeout(context_t *ctx);
+static void update_persist_timer(context_t *ctx);
+static uint64_t persist_timeout(context_t *ctx);
+static void handle_persist_timeout(mysocket_t sd, context_t *ctx);
+static void retransmit_lost_segments(mysocket_t sd, context_t *ctx);
+static bool_t queue_out_of_order(context_t *ctx, tcp_seq seq,
+                                 const char *data, size_t len);
+static void report_duplicate(context_t *ctx, tcp_seq left, tcp_seq right);
+static void handle_dsack(context_t *ctx, tcp_seq ack,
+                         const sack_block_t *blocks, int num_blocks);
+static void save_undo_state(context_t *ctx);
+static void note_retransmission(context_t *ctx);
+static void deliver_out_of_order(mysocket_t sd, context_t *ctx);
+static int build_sack_blocks(context_t *ctx, sack_block_t *blocks, int max_blocks);
+static const uint8_t *find_option(const tcphdr *hdr, size_t len, uint8_t kind);
+static int parse_sack_option(const tcphdr *hdr, size_t len, sack_block_t *blocks);
+static size_t build_options(context_t *ctx, uint8_t flags, uint8_t *opts,
+                            size_t room);
+static void parse_syn_options(context_t *ctx, const tcphdr *hdr, size_t len);
+static bool_t parse_timestamp_option(const tcphdr *hdr, size_t len,
+                                     uint32_t *tsval, uint32_t *tsecr);
+static bool_t check_timestamps(context_t *ctx, const tcphdr *hdr, size_t len,
+                               uint32_t *tsecr);
+static uint32_t ts_now(void);
+static uint16_t advertised_window(mysocket_t sd, context_t *ctx, uint8_t flags);
+static tcp_seq receive_space(mysocket_t sd, context_t *ctx);
+static bool_t window_update_due(mysocket_t sd, context_t *ctx);
+static void tune_recv_buffer(context_t *ctx, uint64_t now);
 
 
 /* initialise the transport layer, and start the main loop, handling
@@ -58,25 +321,39 @@ static void control_loop(mysocket_t sd, context_t *ctx);
 void transport_init(mysocket_t sd, bool_t is_active)
 {
     context_t *ctx;
-    ctx = (context_t *) calloc(1, sizeof(context_t));
+    void *mem;
+
+    //Aligned so each group of fields really starts its own cache line
+    if (posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(context_t)) != 0)
+        mem = NULL;
+    ctx = (context_t *) mem;
     assert(ctx);
-    ctx->hdr_buffer = (tcphdr*)calloc(1,sizeof(tcphdr));
-    assert(ctx->hdr_buffer);
-    ctx->congestion_win = bit_win;
-    ctx->recv_win = bit_win;
-    ctx->send_win = bit_win;
+    //Header template fields we never set (ports, checksum, urgent
+    //pointer) stay zero
+    memset(ctx, 0, sizeof(context_t));
+    //Until the handshake settles it, only send what any peer can take
+    ctx->max_packet = std::min(stcp_network_max_datagram(sd), (size_t)MAX_PACKET_LEN);
+    ctx->rcv_mss = std::min(ctx->max_packet - sizeof(tcphdr), (size_t)0xffff);
+    ctx->mss = STCP_MSS;
+    //Room for a few of the largest segments we take, even super-frames
+    ctx->recv_win = std::max((tcp_seq)RECV_BUF_INITIAL, 4 * ctx->rcv_mss);
+    ctx->ack_mode = stcp_get_ack_mode(sd);
+    ctx->nodelay = stcp_get_nodelay(sd);
+    ctx->max_rate = stcp_get_max_rate(sd);
+    ctx->ack_every = ACK_EVERY;
+    //Smallest shift that lets th_win describe the largest receive window
+    while (ctx->rcv_wscale < TCP_MAX_WINSHIFT &&
+           (RECV_WIN_MAX >> ctx->rcv_wscale) > 0xffff)
+        ctx->rcv_wscale++;
+    ctx->rto = RTO_INITIAL;
 
     generate_initial_seq_num(ctx);
     ctx->curr_sequence_num = ctx->initial_sequence_num;
 
-    ctx->last_byte_sent = (int*)calloc(1,sizeof(int));
-    assert(ctx->last_byte_sent);
-    ctx->last_byte_ack = (int*)calloc(1,sizeof(int));
-    assert(ctx->last_byte_ack);
-    *ctx->last_byte_sent = ctx->initial_sequence_num;
-    *ctx->last_byte_ack = ctx->initial_sequence_num;
+    ctx->last_byte_sent = ctx->initial_sequence_num;
+    ctx->last_byte_ack = ctx->initial_sequence_num;
+
 
-  
     /* XXX: you should send a SYN packet here if is_active, or wait for one
     * to arrive if !is_active.  after the handshake completes, unblock the
     * application with stcp_unblock_application(sd).  you may also use
@@ -84,183 +361,161 @@ void transport_init(mysocket_t sd, bool_t is_active)
     * if connection fails; to do so, just set errno appropriately (e.g. to
     * ECONNREFUSED, etc.) before calling the function.
     */
-    ctx -> connection_state = CSTATE_HANDSHAKING;
-    if (is_active) {
-    	//Creating SYN header to send
-    	tcphdr *synhdr;
-    	synhdr = (tcphdr *)calloc(1, sizeof(tcphdr));
-    	assert(synhdr);
-    	//Setting flags in header
-    	synhdr->th_seq = htonl(ctx->curr_sequence_num);
-    	synhdr->th_flags = TH_SYN;
-    	synhdr->th_win = htons(bit_win);
-    	//First handshake
-    	if ((stcp_network_send(sd, synhdr, sizeof(tcphdr),NULL)) == -1){
-    	   dprintf("Error: stcp_network_send()");
-    	   exit(-1);
-    	}
-    	//Undoing the htonl that we did for the send
-    	synhdr->th_seq = ntohl(synhdr->th_seq);
-    	*(ctx->last_byte_sent) = ctx->curr_sequence_num; 
-    	//Recieving from network requires setting the correct recv window
-    	if ((stcp_network_recv(sd, (void*)ctx->hdr_buffer, ctx->recv_win))
-    		== -1){
-            dprintf("Error: stcp_network_recv()");
-            exit(-1);
-    	}
-
-    	ctx->their_recv_win = ntohs(ctx->hdr_buffer->th_win);
-    	ctx->send_win = std::min(ctx->their_recv_win, ctx->congestion_win);
-
-    	//See if packet recv is the SYN_ACK packet
-    	//Bitwise and to check for both the SYN flag and ACK flag
-    	if (ctx->hdr_buffer->th_flags & (TH_SYN | TH_ACK)){
-            //Check to see if peer's ack seq# is our SYN's seq# + 1
-            //If so, send ACK in response
-            if (ctx->hdr_buffer->th_ack == synhdr->th_seq + 1){
-                *(ctx->last_byte_sent) = ctx->curr_sequence_num;
-            	ctx->curr_sequence_num = ctx->hdr_buffer->th_ack;
-            	*(ctx->last_byte_ack) = ctx->hdr_buffer->th_ack - 1; 
-
-            	//Creating ACK header for last handshake
-            	tcphdr *ackhdr;
-            	ackhdr = (tcphdr *)calloc(1, sizeof(tcphdr));
-            	assert(ackhdr);
-            	ackhdr->th_ack = ctx->hdr_buffer->th_seq + 1;
-            	ctx->last_ack_num_sent = ackhdr->th_ack;
-            	ackhdr->th_flags = TH_ACK;
-            	//Sliding window calculation
-            	ctx->send_win = std::min(ctx->congestion_win, ctx->their_recv_win) - (ctx->last_byte_sent - ctx->last_byte_ack);
-            	ackhdr->th_win = htons(bit_win);
-        		if ((stcp_network_send(sd, ackhdr, sizeof(tcphdr),NULL)) == -1){
-                    dprintf("Error: stcp_network_send()");
-                    exit(-1);
-        		}
-                //If the ack number recieved is incorrect
-            }
-            else{
-                dprintf("Error: ACK number incorrect");
-                exit(-1);
-            }
-    	}
-    	//Simultaneous syns sent
-    	else if(ctx->hdr_buffer->th_flags & TH_SYN) {
-            //Send SYN ACK, with our previous SEQ number, and their SEQ + 1
-            tcphdr *synack;
-            synack = (tcphdr*)calloc(1, sizeof(tcphdr));
-            assert(synack);
-            synack->th_seq = ctx->curr_sequence_num;
-            synack->th_ack = ctx->hdr_buffer->th_seq+1;
-            //Sliding window calculation 
-            ctx->last_ack_num_sent = synack->th_ack;
-            ctx->send_win = std::min(ctx->congestion_win, ctx->their_recv_win) - (ctx->last_byte_sent - ctx->last_byte_ack);
-
-            synack->th_win = htons(bit_win);
-            if ((stcp_network_send(sd, synack, sizeof(tcphdr), NULL)) == -1){
-                dprintf("Error: stcp_network_send()");
-                exit(-1);
-            }
+    ctx->connection_state = CSTATE_HANDSHAKING;
+    if (handshake(sd, ctx, is_active)){
+        //The window is counted in segments of the size just agreed
+        congestion_init(&ctx->cc, stcp_get_congestion_control(sd), ctx->mss);
+        ctx->send_win = std::min(ctx->their_recv_win, ctx->cc.congestion_win);
+        ctx->max_send_win = ctx->their_recv_win;
+        sendbuf_init(&ctx->send_buf, SEND_BUF_SIZE, ctx->curr_sequence_num);
+        ctx->connection_state = CSTATE_ESTABLISHED;
+        stcp_unblock_application(sd);
 
-    	    //Wait on SYN ACK with our SEQ number +1 and their SEQ number again
-    	    if ((stcp_network_recv(sd, (void*)ctx->hdr_buffer, ctx->recv_win))
-                == -1){
-                dprintf("Error: stcp_network_recv()");
-                exit(-1);
-            }
-            //Check to see if SYN ACK
-            if (ctx->hdr_buffer->th_flags & (TH_SYN | TH_ACK)){
-    	  	    //check to see if ACK is  correct
-    	  	    if (ctx->hdr_buffer->th_ack == synhdr->th_seq + 1){
-                    *(ctx->last_byte_sent) = ctx->curr_sequence_num;
-                    ctx->curr_sequence_num = ctx->hdr_buffer->th_ack;
-                    *(ctx->last_byte_ack) = ctx->hdr_buffer->th_ack - 1;
-                }
-                //If ACK is incorrect
-                else{
-                    dprintf("Error: wrong Ack number");
-                    exit(-1);
-                }
-            }
-            //If not SYN ACK after simultaneous SYN's
-            else {
-                dprintf("Error: wrong flags");
-                exit(-1);
+        control_loop(sd, ctx);
+    }
+    //errno says why; myconnect() or myaccept() fails with it
+    else
+        stcp_unblock_application(sd);
+
+    /* do any cleanup here */
+    for (int i = 0; i < NUM_TIMERS; i++)
+        stcp_cancel_timer(sd, i);
+    free_segment_list(ctx->retx_queue.head);
+    free_segment_list(ctx->free_segs);
+    sendbuf_free(&ctx->send_buf);
+    reasm_free(&ctx->reasm);
+    free(ctx);
+}
+
+
+/* the three-way handshake, or a simultaneous open.  the active side sends
+ * a SYN and waits for the SYN-ACK; the passive side waits for a SYN,
+ * answers with a SYN-ACK and waits for the ACK.  our SYN or SYN-ACK is
+ * resent each time the retransmission timer fires, backing off from
+ * RTO_INITIAL (RFC 6298), and a resent SYN from the peer is answered at
+ * once.  segments that don't fit the exchange, such as a SYN-ACK for
+ * some other SYN, are ignored without touching the connection state.
+ * returns TRUE once the connection is established; otherwise errno is
+ * ECONNREFUSED if the peer can't be reached, or ETIMEDOUT after
+ * SYN_RETRIES resends went unanswered.
+ */
+static bool_t handshake(mysocket_t sd, context_t *ctx, bool_t is_active)
+{
+    tcphdr *hdr = (tcphdr *) ctx->recv_buffer;
+    tcp_seq iss = ctx->initial_sequence_num;
+    uint8_t syn_flags = 0;      //our SYN or SYN-ACK, 0 until we owe one
+
+    if (is_active){
+        syn_flags = TH_SYN;
+        if (!send_handshake_segment(sd, ctx, syn_flags))
+            return false;
+    }
+
+    for (;;){
+        unsigned int event;
+        ssize_t len;
+        uint8_t flags;
+
+        sync_timers(sd, ctx);
+        event = stcp_wait_for_event(sd, NETWORK_DATA | TIMER_EXPIRED, NULL);
+
+        if ((event & TIMER_EXPIRED) && ctx->rto_expire &&
+            current_time_us() >= ctx->rto_expire){
+            if (++ctx->retransmits > SYN_RETRIES){
+                dprintf("Error: handshake timed out");
+                errno = ETIMEDOUT;
+                return false;
             }
+            ctx->rto = std::min((uint32_t)RTO_MAX, ctx->rto * 2);
+            if (!send_handshake_segment(sd, ctx, syn_flags))
+                return false;
         }
-    	//If not SYN ACK or SYN received
-    	else {
-            dprintf("Error: wrong flags");
-            exit(-1);
-    	}
-    } 
-    else{
-        //Passively waiting for SYN
-        if ((stcp_network_recv(sd, (void*)ctx->hdr_buffer, sizeof(tcphdr)))
-            == -1){
-        dprintf("Error: stcp_network_recv()");
-        exit(-1);
+        if (!(event & NETWORK_DATA))
+            continue;
+
+        len = stcp_network_recv(sd, hdr, MAX_PACKET_LEN);
+        if (len < (ssize_t)sizeof(tcphdr)){
+            //The network layer signals a dead peer with an empty packet
+            dprintf("Error: stcp_network_recv()");
+            errno = ECONNREFUSED;
+            return false;
         }
-        ctx->their_recv_win = ntohs(ctx->hdr_buffer->th_win);
-        ctx->hdr_buffer->th_seq = ntohl(ctx->hdr_buffer->th_seq);
-        //Check for SYN flag
-        if (ctx->hdr_buffer->th_flags & TH_SYN) {
-            //Send a syn ack in response
-            tcphdr *synack;
-            synack = (tcphdr*)calloc(1, sizeof(synack));
-            assert(synack);
-            synack->th_seq = ctx->curr_sequence_num;
-            synack->th_ack = ctx->hdr_buffer->th_seq + 1;
-            synack->th_flags = (TH_SYN | TH_ACK);
-            //Sliding window calculations
-            ctx->last_ack_num_sent = synack->th_ack;
-            ctx->send_win = std::min(ctx->congestion_win, ctx->their_recv_win) - (ctx->last_byte_sent - ctx->last_byte_ack);
-            synack->th_win = htons(ctx->recv_win);
-            if ((stcp_network_send(sd, synack, sizeof(tcphdr),NULL)) == -1){
+        if (TCP_DATA_START(hdr) < sizeof(tcphdr) || TCP_DATA_START(hdr) > (size_t)len)
+            continue;
+        flags = hdr->th_flags;
+
+        //A SYN-ACK for our SYN: acknowledge it and we are done.  one that
+        //acknowledges anything else is stale, and changes nothing
+        if ((flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK)){
+            if (ntohl(hdr->th_ack) != iss + 1)
+                continue;
+            accept_syn(ctx, hdr, len);
+            if (send_segment(sd, ctx, iss + 1, TH_ACK, 0) == -1){
                 dprintf("Error: stcp_network_send()");
-                exit(-1);
-            }
-            //Wait on ACK
-            if ((stcp_network_recv(sd, (void*)ctx->hdr_buffer, sizeof(tcphdr)))
-                == -1){
-                dprintf("Error: stcp_network_recv()");
-                exit(-1);
-            }
-            ctx->their_recv_win = ntohs(ctx->hdr_buffer->th_win);
-
-            //Check for ACK flag and correct Ack Num
-            if (!(ctx->hdr_buffer->th_flags & TH_ACK)
-                || !(ctx->hdr_buffer->th_ack == ctx->curr_sequence_num+1)){
-                dprintf("Error: Wrong ACK");
-                exit(-1);
-            } else {
-                *(ctx->last_byte_ack)  = ctx->hdr_buffer->th_ack-1;
-
-                *(ctx->last_byte_sent) = ctx->curr_sequence_num;
-                ctx->curr_sequence_num = ctx->hdr_buffer->th_ack;
+                errno = ECONNREFUSED;
+                return false;
             }
+            break;
         }
-        //If Passively waiting and get a packet that isn't a SYN
-        else {
-            dprintf("Error: wrong flags");
-            exit(-1);
+        //A SYN alone: the passive open, a simultaneous one, or a resend
+        //because our SYN-ACK was lost.  answer with a SYN-ACK right away
+        if ((flags & (TH_SYN | TH_ACK)) == TH_SYN){
+            accept_syn(ctx, hdr, len);
+            syn_flags = TH_SYN | TH_ACK;
+            if (!send_handshake_segment(sd, ctx, syn_flags))
+                return false;
+            continue;
+        }
+        //The ACK of our SYN-ACK.  if it was lost, the peer's first data
+        //segment does as well, and is left for the control loop to take
+        //the data from
+        if (syn_flags == (TH_SYN | TH_ACK) && (flags & TH_ACK) &&
+            ntohl(hdr->th_ack) == iss + 1){
+            ctx->their_recv_win = ntohs(hdr->th_win) << ctx->snd_wscale;
+            if ((size_t)len > TCP_DATA_START(hdr) || (flags & TH_FIN))
+                ctx->held_len = len;
+            break;
         }
     }
 
-    ctx->connection_state = CSTATE_ESTABLISHED;
-    stcp_unblock_application(sd);
+    //The SYN is acknowledged; whatever the handshake cost in resends, data
+    //starts over from the initial timeout
+    ctx->curr_sequence_num = iss + 1;
+    ctx->last_byte_sent = iss;
+    ctx->last_byte_ack = iss;
+    ctx->retransmits = 0;
+    ctx->rto = RTO_INITIAL;
+    ctx->rto_expire = 0;
+    return true;
+}
 
-    control_loop(sd, ctx);
-  
-    /* do any cleanup here */
-    free(ctx);
+/* take the peer's sequence number, window and options from a SYN or
+ * SYN-ACK the handshake has accepted; windows in SYNs are never scaled
+ */
+static void accept_syn(context_t *ctx, const tcphdr *hdr, size_t len)
+{
+    ctx->their_recv_win = ntohs(hdr->th_win);
+    ctx->recv_next_seq = ntohl(hdr->th_seq) + 1;
+    parse_syn_options(ctx, hdr, len);
 }
 
+/* (re)send our SYN or SYN-ACK and restart the retransmission timer */
+static bool_t send_handshake_segment(mysocket_t sd, context_t *ctx, uint8_t flags)
+{
+    if (send_segment(sd, ctx, ctx->initial_sequence_num, flags, 0) == -1){
+        dprintf("Error: stcp_network_send()");
+        errno = ECONNREFUSED;
+        return false;
+    }
+    ctx->rto_expire = current_time_us() + ctx->rto;
+    return true;
+}
 
 /* generate random initial sequence number for an STCP connection */
 static void generate_initial_seq_num(context_t *ctx)
 {
     assert(ctx);
-  
+
 #ifdef FIXED_INITNUM
     /* please don't change this! */
     ctx->initial_sequence_num = 1;
@@ -285,220 +540,1500 @@ static void control_loop(mysocket_t sd, context_t *ctx)
 {
     assert(ctx);
     assert(!ctx->done);
-    assert(ctx->hdr_buffer);
-    ctx->data_buffer = (char*)calloc(1, sizeof(bit_win));
-    assert(ctx->data_buffer);
-    //timespec *abstime;
-    //abstime= (timespec*)malloc(sizeof(timespec*));
-    //abstime->tv_sec = 5;
-    //abstime->tv_nsec = 5000;
-    bool finRecv = false;
-    bool finSent = false;
-    bool timeOut = true;
-    int max_send_window; 
-    int data_in_flight;
-    tcp_seq finNum;
     while (!ctx->done){
         unsigned int event;
-	
+        unsigned int wait_flags = NETWORK_DATA | APP_CLOSE_REQUESTED | TIMER_EXPIRED;
+
+        //Only take more data from the app while there is room to hold it
+        //until it is acknowledged
+        if (ctx->send_buf.len < ctx->send_buf.size && !ctx->close_requested)
+            wait_flags |= APP_DATA;
+
+        //Hear about app reads while the window we offered is small, so the
+        //space they free can be offered to the peer
+        if (ctx->recv_adv_set && !ctx->fin_recv &&
+            SEQ_LT(ctx->recv_adv, ctx->recv_next_seq + ctx->recv_win / 2))
+            wait_flags |= APP_DATA_READ;
+
+        //The timer wheel wakes us when any of our timers is due
+        sync_timers(sd, ctx);
+
         /* see stcp_api.h or stcp_api.c for details of this function */
-        /* XXX: you will need to change some of these arguments! */
-        if (timeOut){
-    		event = stcp_wait_for_event(sd, ANY_EVENT, NULL);
-        }
-        else{
-        	event = stcp_wait_for_event(sd, ANY_EVENT, NULL);
-        }
-	 	if (event & TIMEOUT)
+        //A segment the handshake ended on is handled before anything else
+        event = ctx->held_len ? (unsigned int)NETWORK_DATA
+                              : stcp_wait_for_event(sd, wait_flags, NULL);
+
+	 	if (event & TIMER_EXPIRED)
         {
-            dprintf("Error: TIMEOUT");
-            exit(-1);
+            //Each handler checks its own expiry, so early or stale
+            //wakeups are harmless
+            handle_delack_timeout(sd, ctx);
+            handle_rack_timeout(ctx);
+            handle_tlp_timeout(sd, ctx);
+            handle_retransmit_timeout(sd, ctx);
+            handle_persist_timeout(sd, ctx);
+            handle_pace_timeout(ctx);
+            if (ctx->done)
+                break;
+            retransmit_lost_segments(sd, ctx);
         }
         /* check whether it was the network, app, or a close request */
         /*********************************APP_DATA***********************************/
-        if ((event & APP_DATA) || ((event & ANY_EVENT) == (3 | 5 | 7))){	// handle event 1,3,5,7
+        if (event & APP_DATA){
             /* the application has requested that data be sent */
             /* see stcp_app_recv() */
-            //Read data with stcp_app_recv(sd,dst,size) into dst as a char*
-            //Sliding window calculations
-            max_send_window = std::min(ctx->their_recv_win, ctx->congestion_win);
-            data_in_flight = *(ctx->last_byte_sent) - *(ctx->last_byte_ack);
-            //Get data from the app
-
-            if (stcp_app_recv(sd, ctx->data_buffer, (max_send_window - data_in_flight) - 1) == (size_t)-1){
-            	dprintf("Error: stcp_app_recv()");
-            	exit(-1);
-            }
-            //Create packet with correct seq# and sending window
-            tcphdr* datahdr;
-            datahdr = (tcphdr*)calloc(1, sizeof(tcphdr));
-            assert(datahdr);
-            datahdr->th_seq = ctx->curr_sequence_num;
-            //Send to network layer using stcp_network_send(sd, src, size, ...) as two packet(hdr, data)
-            //Here need to convert multi byte data being sent with htons (dbuffer)
-
-
-            datahdr->th_win = htons(bit_win);
-            if (stcp_network_send(sd, datahdr, sizeof(tcphdr), (void *)(ctx->data_buffer), sizeof(tcphdr), NULL) == -1){
-            	dprintf("Error: stcp_network_send()");
-            	exit(-1);
-            }
-            *(ctx->last_byte_sent) = ctx->curr_sequence_num + sizeof(*(ctx->data_buffer)) - 1;
-            ctx->curr_sequence_num = *(ctx->last_byte_sent) + 1;
+            //Writes go straight into the send buffer, where they coalesce;
+            //send_pending_data() below decides when they go out
+            size_t room;
+            char *tail = sendbuf_tail(&ctx->send_buf, &room);
+            size_t got = stcp_app_recv(sd, tail, room);
+
+            sendbuf_commit(&ctx->send_buf, got);
+            ctx->pending_len += got;
         }
+        /*******************************APP_DATA_READ*********************************/
+        if ((event & APP_DATA_READ) && window_update_due(sd, ctx))
+            send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
         /********************************NETWORK_DATA**********************************/
-        // handle 2,3,6,7
-        if ((event & NETWORK_DATA) || ((event & ANY_EVENT) == (3 | 6 | 7)))
+        if (event & NETWORK_DATA)
         {
-            void* recvBuffer;
-            size_t receivedData;
+            char* recvBuffer;
+            ssize_t receivedData;
+            tcphdr* recvhdr;
+            size_t hdr_size;
             tcp_seq recvSeqNum;
-            tcp_seq lastRecvNum;
-            int duplicateDataSize;
-            int max_send_window = std::min(ctx->their_recv_win, ctx->congestion_win); 
-            int data_in_flight = *(ctx->last_byte_sent) - *(ctx->last_byte_ack);
-            recvBuffer = malloc(max_send_window - data_in_flight);
-            receivedData = stcp_network_recv(sd, recvBuffer, (max_send_window - data_in_flight)) ;
-            if (receivedData == (size_t)-1){
+            size_t payload_len;
+            bool ackNeeded = false;
+            bool ackNow = false;
+            bool isDupAck;
+            uint32_t tsecr = 0;
+
+            recvBuffer = ctx->recv_buffer;
+            if (ctx->held_len){
+                receivedData = ctx->held_len;
+                ctx->held_len = 0;
+            }
+            else
+                receivedData = stcp_network_recv(sd, recvBuffer, MAX_PACKET_LEN);
+            if (receivedData < (ssize_t)sizeof(tcphdr)){
+                //The network layer signals a dead peer with an empty packet
                 dprintf("Error: stcp_network_recv()");
-                exit(-1);
+                errno = ECONNRESET;
+                ctx->done = true;
+                break;
             }
 
-			ctx->hdr_buffer = (struct tcphdr *) recvBuffer;
-			size_t hdr_size = ((struct tcphdr *)recvBuffer)->th_off * sizeof(uint32_t);
-
-
-			ctx->their_recv_win = ntohs(ctx->hdr_buffer->th_win);
-		
-		//*******************CHECK FOR FIN OR ACK ONLY HEADER**********************************
-			//if data size is only the size of a header
-			if(receivedData == hdr_size){	
-				tcphdr *ackhdr;
-				ackhdr = (tcphdr *)calloc(1, sizeof(ackhdr));
-				assert(ackhdr);
-				ackhdr->th_flags = TH_ACK;
-				ackhdr->th_ack = ctx->hdr_buffer->th_seq + 1;
-				ctx ->last_ack_num_sent = ackhdr->th_ack;
-				ackhdr->th_win = ctx->recv_win;
-
-				//check if just an ACK, otherwise check flags and send an ACK if necessary
-				if (ctx->hdr_buffer->th_flags & TH_ACK){
-					*ctx->last_byte_ack = ctx->hdr_buffer->th_ack-1;
-					//once ack for FIN is receieved, stop timeouts
-					if(ctx->hdr_buffer->th_ack == finNum)
-					{
-						timeOut = false;
-					}
-				}
-				else if(ctx->hdr_buffer->th_flags  & (TH_FIN | TH_ACK))
-				{
-					*ctx->last_byte_ack = ctx->hdr_buffer->th_ack-1;
-					finRecv = true;
-
-					if(ctx->hdr_buffer->th_ack == finNum)
-					{
-						timeOut = false;
-					}
+			recvhdr = (tcphdr*)recvBuffer;
+			hdr_size = TCP_DATA_START(recvBuffer);
+			if (hdr_size < sizeof(tcphdr) || hdr_size > (size_t)receivedData)
+				continue;
+			payload_len = receivedData - hdr_size;
+			recvSeqNum = ntohl(recvhdr->th_seq);
 
-					stcp_network_send(sd,ackhdr,sizeof(ackhdr));
-				}
-				else if (ctx->hdr_buffer->th_flags & TH_FIN){
-					finRecv = true;
-					stcp_network_send(sd,ackhdr,sizeof(ackhdr));
-				}
+			//PAWS: a segment stamped before the last one we took a timestamp
+			//from is an old duplicate, even if its sequence number has wrapped
+			//back into the window.  it is dropped, and any data or FIN in it
+			//acknowledged again
+			if (ctx->ts_ok && !check_timestamps(ctx, recvhdr, receivedData, &tsecr)){
+				if (payload_len > 0 || (recvhdr->th_flags & TH_FIN))
+					send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
+				continue;
 			}
-		//*******************RECIEVED A DATA PACKET **********************************
-			else{
-				//See if there was an ACK or FIN
-				if(ctx->hdr_buffer->th_flags  & (TH_SYN | TH_ACK))
-				{
-					*ctx->last_byte_ack = ctx->hdr_buffer->th_ack-1;
-					finRecv = true;
-					if(ctx->hdr_buffer->th_ack == finNum)
-					{
-						timeOut = false;
-					}
-				}
-				else if (ctx->hdr_buffer->th_flags & TH_ACK){
-					*ctx->last_byte_ack = ctx->hdr_buffer->th_ack-1;
-					if(ctx->hdr_buffer->th_ack == finNum)
-					{
-						timeOut = false;
-					}
-				}
-				else if (ctx->hdr_buffer->th_flags & TH_FIN){
-					finRecv = true;
-				}
 
-				recvSeqNum = ctx->hdr_buffer->th_seq;
+			//A resent SYN or SYN-ACK means the peer missed our answer to it.
+			//its window is unscaled and it carries nothing else, so just ACK
+			if (recvhdr->th_flags & TH_SYN){
+				send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
+				continue;
+			}
+
+			//An empty segment from before recv_next_seq is a window probe
+			//(or a stale ACK); answer it with our current window
+			if (payload_len == 0 && !(recvhdr->th_flags & (TH_SYN | TH_FIN)) &&
+				SEQ_LT(recvSeqNum, ctx->recv_next_seq))
+				ackNow = true;
+
+			//RFC 5681 duplicate ACK: nothing new acknowledged, no data, no
+			//window change, while we have data outstanding
+			isDupAck = (recvhdr->th_flags & TH_ACK) && payload_len == 0 &&
+			           !(recvhdr->th_flags & (TH_SYN | TH_FIN)) &&
+			           ctx->retx_queue.head &&
+			           ntohl(recvhdr->th_ack) == (tcp_seq)(ctx->last_byte_ack + 1) &&
+			           (tcp_seq)(ntohs(recvhdr->th_win) << ctx->snd_wscale) == ctx->their_recv_win;
+
+			ctx->their_recv_win = ntohs(recvhdr->th_win) << ctx->snd_wscale;
+			ctx->max_send_win = std::max(ctx->max_send_win, ctx->their_recv_win);
+
+		//*******************ACKNOWLEDGEMENT**********************************
+			if (recvhdr->th_flags & TH_ACK){
+				sack_block_t blocks[TCP_MAX_SACK_BLOCKS];
+				int num_blocks = 0;
+
+				if (ctx->sack_ok)
+					num_blocks = parse_sack_option(recvhdr, receivedData, blocks);
+				//A D-SACK must be seen before the ACK can end a probe episode
+				if (num_blocks > 0)
+					handle_dsack(ctx, ntohl(recvhdr->th_ack), blocks, num_blocks);
+				handle_ack(ctx, ntohl(recvhdr->th_ack), tsecr);
+				if (num_blocks > 0)
+					handle_sack(ctx, blocks, num_blocks);
+				if (isDupAck)
+					handle_duplicate_ack(ctx);
+				if (ctx->sack_ok)
+					rack_detect_losses(ctx, current_time_us());
+				retransmit_lost_segments(sd, ctx);
+			}
 
-				//Check to see if there was duplicate data
-				if(recvSeqNum < ctx->last_ack_num_sent){
-					//Check to see if the duplicate data is large enough that it introduces new data
-					if(recvSeqNum + (receivedData - hdr_size) > ctx-> last_ack_num_sent){
-						duplicateDataSize = (ctx->last_ack_num_sent-1) - recvSeqNum;
-						stcp_app_send(sd, recvBuffer+hdr_size + duplicateDataSize,receivedData - (hdr_size + duplicateDataSize));
-						lastRecvNum = recvSeqNum + (receivedData - hdr_size);
+		//*******************RECIEVED A DATA PACKET **********************************
+			if (payload_len > 0){
+				ackNeeded = true;
+				//Pass up only the part of the segment we have not seen yet
+				if (SEQ_LEQ(recvSeqNum, ctx->recv_next_seq) &&
+					SEQ_GT(recvSeqNum + payload_len, ctx->recv_next_seq) &&
+					!ctx->fin_recv){
+					size_t duplicateDataSize = ctx->recv_next_seq - recvSeqNum;
+					if (duplicateDataSize > 0)
+						report_duplicate(ctx, recvSeqNum, ctx->recv_next_seq);
+					stcp_app_send(sd, recvBuffer + hdr_size + duplicateDataSize,
+					              payload_len - duplicateDataSize);
+					ctx->recv_next_seq = recvSeqNum + payload_len;
+					//This may have filled the hole in front of held data; if
+					//so, tell the sender straight away
+					if (ctx->reasm.head){
+						deliver_out_of_order(sd, ctx);
+						ackNow = true;
 					}
+					tune_recv_buffer(ctx, current_time_us());
 				}
+				//Hold data that arrived early so the peer only resends the gap
 				else{
-				//If no duplicate data, pass everything up to the application
-				stcp_app_send(sd, recvBuffer+hdr_size,receivedData - hdr_size);
-				lastRecvNum = recvSeqNum + (receivedData - hdr_size);
+					if (SEQ_LEQ(recvSeqNum + payload_len, ctx->recv_next_seq) ||
+						(SEQ_GT(recvSeqNum, ctx->recv_next_seq) && !ctx->fin_recv &&
+						 !queue_out_of_order(ctx, recvSeqNum, recvBuffer + hdr_size,
+						                     payload_len)))
+						report_duplicate(ctx, recvSeqNum, recvSeqNum + payload_len);
+					//Out of order or duplicate: the sender needs to hear now
+					ackNow = true;
 				}
+			}
 
-				//Send an ACK based on the data recieved
-				tcphdr *ackhdr;
-				ackhdr = (tcphdr *)calloc(1, sizeof(ackhdr));
-				assert(ackhdr);
-				ackhdr->th_flags = TH_ACK;
-				ackhdr->th_ack = lastRecvNum + 1;
-				ctx ->last_ack_num_sent = ackhdr->th_ack;
-				ackhdr->th_win = ctx->recv_win;
-				stcp_network_send(sd,ackhdr,sizeof(ackhdr));
+		//*******************CHECK FOR FIN**********************************
+			if (recvhdr->th_flags & TH_FIN){
+				ackNeeded = true;
+				ackNow = true;
+				//Only accept the FIN once everything before it has arrived;
+				//until then remember where it goes
+				if (!ctx->fin_recv &&
+					SEQ_GEQ(recvSeqNum + payload_len, ctx->recv_next_seq)){
+					ctx->fin_pending = true;
+					ctx->fin_seq = recvSeqNum + payload_len;
+				}
 			}
-			//If we received a FIN, the peer no longer has anything to send us
-			//ACK the FIN and wait on the app to give us everything
-			if(finRecv)
-			{
+			if (ctx->fin_pending && ctx->fin_seq == ctx->recv_next_seq){
+				ctx->recv_next_seq++;
+				ctx->fin_pending = false;
+				ctx->fin_recv = true;
+				//The peer no longer has anything to send us
 				stcp_fin_received(sd);
 			}
+
+			//Acknowledge data and FINs, including duplicates whose ACK was lost;
+			//in-order data may wait for the next segment or the delayed ACK timer
+			if (ackNow || (ackNeeded && ctx->reasm.head))
+				send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
+			else if (ackNeeded)
+				schedule_ack(sd, ctx, current_time_us());
 		}
 	/***********************************APP_CLOSE_REQUESTED*************************/
-		//Handle 4,5,6,7
-		if ((event & APP_CLOSE_REQUESTED) || ((event & ANY_EVENT) == (5 | 6 | 7))){
-			//Send FIN packet to network layer
-			tcphdr* finhdr;
-			finhdr = (tcphdr*)calloc(1, sizeof(tcphdr));
-			assert(finhdr);
-			finhdr->th_seq = htons(ctx->curr_sequence_num);
-			finhdr->th_flags = TH_FIN;
-			finhdr->th_win = ctx->recv_win;
-			//send the header
-			if (stcp_network_send(sd, finhdr, sizeof(finhdr),NULL) == -1){
-				dprintf("Error: stcp_network_send()");
-				exit(-1);
-			}
-			//increment by one because a FIN header is sent
-			*(ctx->last_byte_sent)= *(ctx->last_byte_sent) + 1;
-			//look for ACK for FIN
-			finNum = *(ctx->last_byte_sent) + 1;
-			finSent = true;
-			timeOut = true;
+		if (event & APP_CLOSE_REQUESTED)
+			ctx->close_requested = true;
+
+		//ACKs and app writes may both have made something sendable
+		send_pending_data(sd, ctx);
+		update_persist_timer(ctx);
+
+		//All app data has been handed to us, so the FIN follows the last of it
+		if (ctx->close_requested && !ctx->pending_len && !ctx->fin_sent){
+			transmit_new_segment(sd, ctx, TH_FIN | TH_ACK, 0);
+			ctx->fin_sent = true;
+			ctx->connection_state = CSTATE_CLOSING;
  		}
 
-   		if(finSent && finRecv)
+		//Both directions are finished once our FIN is acknowledged
+   		if(ctx->fin_sent && ctx->fin_recv && !ctx->retx_queue.head)
 		{
+			ctx->connection_state = CSTATE_CLOSED;
 			ctx->done = true;
 		}
 	}
 }
 
+/* how much new data the peer's window and the congestion window allow.
+ * the peer's window has to hold everything past snd_una, SACKed or not;
+ * the congestion window only limits what is still in the network
+ */
+static void update_send_window(context_t *ctx)
+{
+    tcp_seq outstanding = ctx->last_byte_sent - ctx->last_byte_ack;
+    tcp_seq in_pipe = pipe_bytes(ctx);
+
+    ctx->send_win = std::min(
+        (outstanding < ctx->their_recv_win) ? ctx->their_recv_win - outstanding : 0,
+        (in_pipe < ctx->cc.congestion_win) ? ctx->cc.congestion_win - in_pipe : 0);
+}
+
+/* send as much pending app data as the window allows, avoiding small
+ * segments: a partial segment goes out only when nothing else is in flight
+ * (Nagle, RFC 896) or the app is closing, and a window too small for the
+ * pending data is used only once it is half the largest the peer has
+ * offered (sender-side SWS avoidance, RFC 9293 3.8.6.2.1)
+ */
+static void send_pending_data(mysocket_t sd, context_t *ctx)
+{
+    for (;;){
+        bool_t idle = (ctx->last_byte_sent == ctx->last_byte_ack);
+        size_t len;
+
+        update_send_window(ctx);
+        len = std::min((size_t)ctx->send_win, ctx->pending_len);
+        len = std::min(len, (size_t)ctx->mss);
+        if (!len || !pacing_allows(ctx, current_time_us()))
+            return;
+
+        if (len < ctx->mss){
+            bool_t all = (len == ctx->pending_len);
+            bool_t big_window = (len >= ctx->max_send_win / 2);
+
+            //An idle connection always sends what it can, so it can't stall
+            if (!idle && !(all ? (ctx->nodelay || ctx->close_requested) : big_window))
+                return;
+        }
+
+        send_pending_segment(sd, ctx, len);
+    }
+}
+
+/* send the next len bytes of the pending data as a new segment */
+static void send_pending_segment(mysocket_t sd, context_t *ctx, size_t len)
+{
+    //Sending less than a full segment because there was no more data means
+    //the app, not the window, is holding us back
+    ctx->app_limited = (len == ctx->pending_len && len < ctx->mss);
+    transmit_new_segment(sd, ctx, TH_ACK, len);
+    ctx->pending_len -= len;
+}
+
+/* current time in microseconds, on the timer wheel's monotonic clock */
+static uint64_t current_time_us(void)
+{
+    return stcp_now();
+}
+
+/* fill in the connection's header template for the given sequence number
+ * and flags and send it, along with data_len bytes of payload from the
+ * send buffer, as a single datagram.  returns the result of
+ * stcp_network_send().
+ */
+static ssize_t send_segment(mysocket_t sd, context_t *ctx, tcp_seq seq,
+                            uint8_t flags, size_t data_len)
+{
+    tcphdr *hdr = (tcphdr *)ctx->send_hdr;
+    size_t hdr_len;
+
+    hdr_len = sizeof(tcphdr) +
+              build_options(ctx, flags, (uint8_t *)(hdr + 1),
+                            ctx->max_packet - sizeof(tcphdr) - data_len);
+    hdr->th_seq = htonl(seq);
+    hdr->th_ack = 0;
+    hdr->th_off = hdr_len / sizeof(uint32_t);
+    hdr->th_flags = flags;
+    hdr->th_win = htons(advertised_window(sd, ctx, flags));
+    //Every data segment, new or resent, spends pacing credit
+    if (data_len > 0)
+        pace_segment(ctx, data_len, current_time_us());
+    if (flags & TH_ACK){
+        hdr->th_ack = htonl(ctx->recv_next_seq);
+        ctx->last_ack_num_sent = ctx->recv_next_seq;
+        //Any ACK we were holding back rides along with this segment
+        ctx->segs_unacked = 0;
+        ctx->delack_expire = 0;
+    }
+
+    if (data_len > 0){
+        sendbuf_slice_t slices[2];
+
+        //Data that wraps around the end of the ring goes as two pieces
+        if (sendbuf_peek(&ctx->send_buf, seq, data_len, slices) == 2)
+            return stcp_network_send(sd, hdr, hdr_len,
+                                     slices[0].data, slices[0].len,
+                                     slices[1].data, slices[1].len, NULL);
+        return stcp_network_send(sd, hdr, hdr_len,
+                                 slices[0].data, slices[0].len, NULL);
+    }
+    return stcp_network_send(sd, hdr, hdr_len, NULL);
+}
+
+/* send a new segment at the current sequence number, and track it on the
+ * retransmission queue until the peer acknowledges it.  its payload is
+ * the next data_len bytes of the send buffer, which stay there until then.
+ */
+static void transmit_new_segment(mysocket_t sd, context_t *ctx, uint8_t flags,
+                                 size_t data_len)
+{
+    retx_segment_t *seg;
+
+    assert(data_len <= ctx->mss);
+    seg = alloc_segment(ctx);
+    seg->seq = ctx->curr_sequence_num;
+    seg->seq_len = data_len + ((flags & TH_FIN) ? 1 : 0);
+    seg->flags = flags;
+    seg->data_len = data_len;
+    stamp_segment(ctx, seg, current_time_us());
+
+    if (send_segment(sd, ctx, seg->seq, flags, data_len) == -1){
+        //Leave it queued; the retransmission timer will try again
+        dprintf("Error: stcp_network_send()");
+    }
+
+    if (ctx->retx_queue.tail)
+        ctx->retx_queue.tail->next = seg;
+    else
+        ctx->retx_queue.head = seg;
+    ctx->retx_queue.tail = seg;
+
+    ctx->curr_sequence_num += seg->seq_len;
+    ctx->last_byte_sent = ctx->curr_sequence_num - 1;
+
+    if (!ctx->rto_expire)
+        ctx->rto_expire = current_time_us() + ctx->rto;
+    schedule_tlp(ctx, current_time_us());
+}
+
+/* record the send time of a segment along with the delivery state it
+ * will be measured against when it is acknowledged
+ */
+static void stamp_segment(context_t *ctx, retx_segment_t *seg, uint64_t now)
+{
+    //Nothing outstanding: this segment starts a new flight
+    if (!ctx->retx_queue.head){
+        ctx->first_sent_time = now;
+        ctx->delivered_time = now;
+    }
+
+    seg->sent_time = now;
+    seg->delivered = ctx->delivered;
+    seg->delivered_time = ctx->delivered_time;
+    seg->first_sent_time = ctx->first_sent_time;
+    seg->app_limited = ctx->app_limited;
+}
+
+/* process a cumulative acknowledgement from the peer, dropping every
+ * segment it covers from the retransmission queue.  tsecr is the
+ * timestamp the peer echoed, or 0 if it sent none
+ */
+static void handle_ack(context_t *ctx, tcp_seq ack, uint32_t tsecr)
+{
+    tcp_seq snd_una = ctx->last_byte_ack + 1;
+    uint64_t now = current_time_us();
+    uint64_t sent_time = 0;
+    bool_t ambiguous = false;
+    retx_segment_t newest;
+    congestion_ack_t ack_info;
+
+    //Ignore old ACKs, and ACKs for data we never sent
+    if (!SEQ_GT(ack, snd_una) || SEQ_GT(ack, ctx->curr_sequence_num))
+        return;
+
+    ctx->last_byte_ack = ack - 1;
+    sendbuf_trim(&ctx->send_buf, ack);
+    ctx->retransmits = 0;
+    ctx->dupacks = 0;
+
+    while (ctx->retx_queue.head &&
+           SEQ_LEQ(ctx->retx_queue.head->seq + ctx->retx_queue.head->seq_len, ack)){
+        retx_segment_t *seg = ctx->retx_queue.head;
+        ctx->retx_queue.head = seg->next;
+        if (seg->retransmitted)
+            ambiguous = true;
+        if (seg->sacked)
+            ctx->sacked_bytes -= seg->seq_len;
+        if (seg->lost)
+            ctx->lost_bytes -= seg->seq_len;
+        rack_update(ctx, seg, now);
+        sent_time = seg->sent_time;
+        newest = *seg;
+        release_segment(ctx, seg);
+    }
+    if (!ctx->retx_queue.head)
+        ctx->retx_queue.tail = NULL;
+
+    if (ctx->in_recovery && SEQ_GEQ(ack, ctx->recovery_point))
+        ctx->in_recovery = false;
+    //NewReno partial ACK (RFC 6582): without SACK, the next hole is the new
+    //head, so resend it straight away rather than wait for more dup ACKs
+    else if (ctx->in_recovery && !ctx->sack_ok && ctx->retx_queue.head &&
+             !ctx->retx_queue.head->lost && !ctx->retx_queue.head->retransmitted)
+        mark_lost(ctx, ctx->retx_queue.head);
+
+    memset(&ack_info, 0, sizeof(ack_info));
+    ack_info.now = now;
+    ack_info.bytes_acked = ack - snd_una;
+    ack_info.prior_in_flight = ctx->curr_sequence_num - snd_una;
+    ack_info.in_flight = ctx->curr_sequence_num - ack;
+    ack_info.pace_limited = ctx->pace_limited;
+
+    ctx->delivered += ack_info.bytes_acked;
+    ctx->delivered_time = now;
+    ack_info.delivered = ctx->delivered;
+
+    //Delivery rate over the newest acknowledged segment's flight, measured
+    //over the longer of its send and ACK intervals to damp ACK compression
+    if (sent_time){
+        uint64_t send_elapsed = newest.sent_time - newest.first_sent_time;
+        uint64_t ack_elapsed = now - newest.delivered_time;
+        uint64_t interval = std::max(send_elapsed, ack_elapsed);
+
+        ctx->first_sent_time = newest.sent_time;
+        ack_info.packet_delivered = newest.delivered;
+        ack_info.app_limited = newest.app_limited;
+        if (interval > 0)
+            ack_info.delivery_rate = (ctx->delivered - newest.delivered) *
+                                     1000000 / interval;
+    }
+
+    //Karn's rule: the ACK may be for either copy of a retransmitted segment,
+    //but the echoed timestamp says which one got through.  if the newest
+    //segment acknowledged is itself the one resent, and the echo is of its
+    //latest copy, that copy can still be timed to the microsecond; any
+    //other echo (perhaps of an earlier hole's repair) is timed in ticks
+    if (sent_time && !ambiguous)
+        ack_info.rtt = (uint32_t)(now - sent_time);
+    else if (sent_time && tsecr && newest.retransmitted &&
+             SEQ_GEQ(tsecr, (uint32_t)(sent_time / TS_TICK_US)))
+        ack_info.rtt = (uint32_t)(now - sent_time);
+    else if (sent_time && tsecr && SEQ_GEQ(ts_now(), tsecr))
+        ack_info.rtt = std::max(ts_now() - tsecr, (uint32_t)1) * TS_TICK_US;
+    if (ack_info.rtt)
+        update_rtt(ctx, ack_info.rtt);
+    ack_info.srtt = ctx->srtt;
+
+    ctx->cc.ops->on_ack(&ctx->cc, &ack_info);
+
+    //The probe has been answered.  if it resent old data and that is what
+    //got through, the original was lost and the window must still be cut
+    if (ctx->tlp_outstanding && SEQ_GEQ(ack, ctx->tlp_high_seq)){
+        ctx->tlp_outstanding = false;
+        if (ctx->tlp_retransmitted && !ctx->in_recovery){
+            //If a D-SACK later shows the original got through after all,
+            //the cut is undone.  the probe, which lies at or above the old
+            //snd_una, is the one resend that D-SACK has to cover
+            save_undo_state(ctx);
+            ctx->undo_marker = snd_una;
+            ctx->undo_retrans = 1;
+            ctx->cc.ops->on_loss(&ctx->cc, now, ack_info.prior_in_flight);
+        }
+    }
+
+    //Restart the timers for whatever is still outstanding
+    ctx->rto_expire = ctx->retx_queue.head ? now + ctx->rto : 0;
+    schedule_tlp(ctx, now);
+}
+
+/* the retransmission timer fired: resend the oldest unacknowledged segment,
+ * or give up on the connection if the peer has been silent for too long
+ */
+static void handle_retransmit_timeout(mysocket_t sd, context_t *ctx)
+{
+    retx_segment_t *seg = ctx->retx_queue.head;
+
+    if (!seg || current_time_us() < ctx->rto_expire)
+        return;
+
+    if (++ctx->retransmits > MAX_RETRANSMITS){
+        dprintf("Error: peer not responding");
+        errno = ETIMEDOUT;
+        ctx->done = true;
+        return;
+    }
+
+    //Only react to the first timeout of a loss episode
+    if (ctx->retransmits == 1){
+        //A timeout during recovery extends that episode rather than
+        //starting a new one, so an undo goes back to before both
+        if (!ctx->in_recovery)
+            save_undo_state(ctx);
+        ctx->cc.ops->on_rto(&ctx->cc, current_time_us(),
+                            ctx->last_byte_sent - ctx->last_byte_ack);
+    }
+
+    //Everything the peer has not SACKed is presumed lost; the head goes
+    //now and the rest follows as ACKs reopen the window
+    ctx->lost_bytes = 0;
+    for (retx_segment_t *s = seg; s; s = s->next){
+        s->lost = !s->sacked;
+        if (s->lost)
+            ctx->lost_bytes += s->seq_len;
+    }
+    ctx->in_recovery = true;
+    ctx->recovery_point = ctx->curr_sequence_num;
+    ctx->tlp_outstanding = false;
+    ctx->tlp_expire = 0;
+
+    if (send_segment(sd, ctx, seg->seq, seg->flags, seg->data_len) == -1){
+        dprintf("Error: stcp_network_send()");
+    }
+    if (seg->lost){
+        seg->lost = false;
+        ctx->lost_bytes -= seg->seq_len;
+    }
+    seg->retransmitted = true;
+    note_retransmission(ctx);
+    stamp_segment(ctx, seg, current_time_us());
+
+    //Exponential backoff; kept until a fresh RTT sample arrives
+    ctx->rto = std::min((uint32_t)RTO_MAX, ctx->rto * 2);
+    ctx->rto_expire = seg->sent_time + ctx->rto;
+}
+
+/* bytes we believe are still in the network: everything outstanding, less
+ * what the peer has SACKed and what we have written off as lost
+ */
+static uint32_t pipe_bytes(context_t *ctx)
+{
+    uint32_t outstanding = ctx->last_byte_sent - ctx->last_byte_ack;
+    uint32_t left = ctx->sacked_bytes + ctx->lost_bytes;
+
+    //Without SACK, each duplicate ACK stands for a segment that has left
+    //the network (the window inflation of RFC 5681 fast recovery)
+    if (!ctx->sack_ok)
+        left += ctx->dupacks * ctx->cc.mss;
+    return outstanding - std::min(outstanding, left);
+}
+
+/* mark the segments covered by the peer's SACK blocks on the scoreboard,
+ * then look for holes that can now be presumed lost
+ */
+static void handle_sack(context_t *ctx, const sack_block_t *blocks, int num_blocks)
+{
+    tcp_seq snd_una = ctx->last_byte_ack + 1;
+
+    for (int i = 0; i < num_blocks; i++){
+        //Ignore blocks below snd_una (D-SACKs) or beyond anything we sent
+        if (!SEQ_LT(blocks[i].left, blocks[i].right) ||
+            !SEQ_GT(blocks[i].left, snd_una) ||
+            SEQ_GT(blocks[i].right, ctx->curr_sequence_num))
+            continue;
+
+        for (retx_segment_t *seg = ctx->retx_queue.head; seg; seg = seg->next){
+            if (SEQ_GEQ(seg->seq, blocks[i].right))
+                break;
+            if (seg->sacked || SEQ_LT(seg->seq, blocks[i].left) ||
+                SEQ_GT(seg->seq + seg->seq_len, blocks[i].right))
+                continue;
+            seg->sacked = true;
+            ctx->sacked_bytes += seg->seq_len;
+            rack_update(ctx, seg, current_time_us());
+            if (seg->lost){
+                seg->lost = false;
+                ctx->lost_bytes -= seg->seq_len;
+            }
+        }
+    }
+
+    detect_losses(ctx);
+}
+
+/* RFC 6675 IsLost(): a hole is lost once DUP_THRESH segments, or more than
+ * (DUP_THRESH - 1) * MSS bytes, above it have been SACKed.  the first new
+ * loss of an episode cuts the congestion window.
+ */
+static void detect_losses(context_t *ctx)
+{
+    uint32_t sacked_above = ctx->sacked_bytes;
+    int sacked_segs_above = 0;
+    bool_t newly_lost = false;
+    retx_segment_t *seg;
+
+    for (seg = ctx->retx_queue.head; seg; seg = seg->next)
+        if (seg->sacked)
+            sacked_segs_above++;
+
+    for (seg = ctx->retx_queue.head; seg && sacked_above; seg = seg->next){
+        if (seg->sacked){
+            sacked_above -= seg->seq_len;
+            sacked_segs_above--;
+            continue;
+        }
+        //Segments already resent are left to the retransmission timer
+        if (seg->lost || seg->retransmitted)
+            continue;
+        if (sacked_segs_above >= DUP_THRESH ||
+            sacked_above > (DUP_THRESH - 1) * ctx->cc.mss){
+            mark_lost(ctx, seg);
+            newly_lost = true;
+        }
+    }
+
+    if (newly_lost)
+        enter_recovery(ctx);
+}
+
+/* count a duplicate ACK; the DUP_THRESH'th one triggers a fast retransmit
+ * of the oldest outstanding segment and starts fast recovery (RFC 5681),
+ * even when SACK has not yet shown enough above the hole
+ */
+static void handle_duplicate_ack(context_t *ctx)
+{
+    retx_segment_t *head = ctx->retx_queue.head;
+
+    if (++ctx->dupacks != DUP_THRESH || ctx->in_recovery)
+        return;
+    if (head && !head->sacked && !head->lost && !head->retransmitted){
+        mark_lost(ctx, head);
+        enter_recovery(ctx);
+    }
+}
+
+/* RACK: note the delivery of a segment.  the most recently sent segment
+ * known to be delivered, and its RTT, are what later losses are judged by
+ */
+static void rack_update(context_t *ctx, const retx_segment_t *seg, uint64_t now)
+{
+    uint32_t rtt = (uint32_t)(now - seg->sent_time);
+
+    //An ACK quicker than any RTT seen must be for an earlier copy of a
+    //retransmitted segment, so it says nothing about the retransmission
+    if (seg->retransmitted && ctx->min_rtt && rtt < ctx->min_rtt)
+        return;
+    if (!seg->retransmitted && (!ctx->min_rtt || rtt < ctx->min_rtt))
+        ctx->min_rtt = std::max(rtt, (uint32_t)1);
+
+    if (seg->sent_time > ctx->rack_xmit_ts ||
+        (seg->sent_time == ctx->rack_xmit_ts &&
+         SEQ_GT(seg->seq + seg->seq_len, ctx->rack_end_seq))){
+        ctx->rack_xmit_ts = seg->sent_time;
+        ctx->rack_end_seq = seg->seq + seg->seq_len;
+        ctx->rack_rtt = rtt;
+    }
+}
+
+/* RACK: a segment sent before the most recently delivered one is lost once
+ * it has been outstanding for rack_rtt plus the reordering window.  those
+ * still inside the window are checked again when rack_expire comes round.
+ */
+static void rack_detect_losses(context_t *ctx, uint64_t now)
+{
+    uint64_t reo_wnd = RACK_REO_WND(ctx->min_rtt);
+    uint64_t wait = 0;
+    bool_t newly_lost = false;
+
+    ctx->rack_expire = 0;
+    if (!ctx->rack_xmit_ts)
+        return;
+
+    for (retx_segment_t *seg = ctx->retx_queue.head; seg; seg = seg->next){
+        uint64_t deadline;
+
+        if (seg->sacked || seg->lost)
+            continue;
+        //Segments are queued in sequence order, not send order, so keep looking
+        if (seg->sent_time > ctx->rack_xmit_ts ||
+            (seg->sent_time == ctx->rack_xmit_ts &&
+             SEQ_GEQ(seg->seq + seg->seq_len, ctx->rack_end_seq)))
+            continue;
+
+        deadline = seg->sent_time + ctx->rack_rtt + reo_wnd;
+        if (deadline <= now){
+            mark_lost(ctx, seg);
+            newly_lost = true;
+        }
+        else
+            wait = std::max(wait, deadline - now);
+    }
+
+    if (newly_lost)
+        enter_recovery(ctx);
+    if (wait)
+        ctx->rack_expire = now + wait;
+}
+
+/* the reordering window ran out for segments RACK was waiting on */
+static void handle_rack_timeout(context_t *ctx)
+{
+    uint64_t now = current_time_us();
+
+    if (!ctx->rack_expire || now < ctx->rack_expire)
+        return;
+    rack_detect_losses(ctx, now);
+}
+
+/* arm the tail loss probe: if nothing is heard for a PTO while data is
+ * outstanding, a probe is sent rather than waiting out the RTO.  TLP_PTO
+ * allows for a delayed ACK, since our receivers hold one back for an odd
+ * tail segment as well as for a lone one.
+ */
+static void schedule_tlp(context_t *ctx, uint64_t now)
+{
+    uint64_t expire;
+
+    ctx->tlp_expire = 0;
+    if (!ctx->sack_ok || !ctx->srtt || ctx->in_recovery ||
+        ctx->tlp_outstanding || !ctx->retx_queue.head)
+        return;
+
+    //Pointless if the RTO would fire first
+    expire = now + TLP_PTO(ctx->srtt);
+    if (!ctx->rto_expire || expire < ctx->rto_expire)
+        ctx->tlp_expire = expire;
+}
+
+/* the probe timeout fired: send new data if there is any, otherwise resend
+ * the last segment, so that the ACK it draws out lets SACK and RACK see any
+ * losses at the tail
+ */
+static void handle_tlp_timeout(mysocket_t sd, context_t *ctx)
+{
+    retx_segment_t *seg = ctx->retx_queue.tail;
+
+    if (!ctx->tlp_expire || current_time_us() < ctx->tlp_expire)
+        return;
+    ctx->tlp_expire = 0;
+    if (!seg || ctx->in_recovery)
+        return;
+
+    ctx->tlp_outstanding = true;
+    if (ctx->pending_len && !ctx->fin_sent &&
+        ctx->their_recv_win > (tcp_seq)(ctx->last_byte_sent - ctx->last_byte_ack)){
+        ctx->tlp_retransmitted = false;
+        send_pending_segment(sd, ctx, std::min((size_t)ctx->mss, ctx->pending_len));
+    }
+    else{
+        ctx->tlp_retransmitted = true;
+        if (send_segment(sd, ctx, seg->seq, seg->flags,
+                         seg->data_len) == -1){
+            dprintf("Error: stcp_network_send()");
+        }
+        seg->retransmitted = true;
+        note_retransmission(ctx);
+        stamp_segment(ctx, seg, current_time_us());
+    }
+    ctx->tlp_high_seq = ctx->curr_sequence_num;
+}
+
+/* hand the timer wheel any of our timers that have been started, moved or
+ * stopped since we last looked
+ */
+static void sync_timers(mysocket_t sd, context_t *ctx)
+{
+    uint64_t expire[NUM_TIMERS];
+
+    expire[TIMER_RTO] = ctx->rto_expire;
+    expire[TIMER_DELACK] = ctx->delack_expire;
+    expire[TIMER_RACK] = ctx->rack_expire;
+    expire[TIMER_TLP] = ctx->tlp_expire;
+    expire[TIMER_PERSIST] = ctx->persist_expire;
+    expire[TIMER_PACE] = ctx->pace_expire;
+
+    for (int i = 0; i < NUM_TIMERS; i++){
+        if (expire[i] == ctx->timer_armed[i])
+            continue;
+        if (expire[i])
+            stcp_set_timer(sd, i, expire[i]);
+        else
+            stcp_cancel_timer(sd, i);
+        ctx->timer_armed[i] = expire[i];
+    }
+}
+
+/* the rate (bytes/sec) to pace data at: the congestion control's rate,
+ * capped by the app's, or 0 to send whenever the window allows
+ */
+static uint64_t pacing_rate(context_t *ctx)
+{
+    uint64_t rate = ctx->cc.ops->pacing_rate(&ctx->cc, ctx->srtt);
+
+    if (ctx->max_rate && (!rate || rate > ctx->max_rate))
+        rate = ctx->max_rate;
+    return rate;
+}
+
+/* may a data segment go now?  if not, the pacing timer is armed for when
+ * it can
+ */
+static bool_t pacing_allows(context_t *ctx, uint64_t now)
+{
+    if (ctx->pace_next <= now){
+        ctx->pace_expire = 0;
+        ctx->pace_limited = false;
+        return true;
+    }
+    ctx->pace_expire = ctx->pace_next;
+    //Held back by the app's cap rather than our own rate, the window
+    //shouldn't grow
+    ctx->pace_limited = !ctx->max_rate ||
+        ctx->cc.ops->pacing_rate(&ctx->cc, ctx->srtt) < ctx->max_rate;
+    return false;
+}
+
+/* push the next departure time back by the time len bytes take at the
+ * pacing rate, first dropping any credit beyond the allowed burst
+ */
+static void pace_segment(context_t *ctx, size_t len, uint64_t now)
+{
+    uint64_t rate = pacing_rate(ctx);
+    uint64_t burst;
+
+    if (!rate){
+        ctx->pace_next = 0;
+        return;
+    }
+    burst = std::max((uint64_t)PACE_BURST_US, 2 * ctx->cc.mss * 1000000 / rate);
+    if (ctx->pace_next + burst < now)
+        ctx->pace_next = now - burst;
+    ctx->pace_next += len * 1000000 / rate;
+}
+
+/* the pacer has credit again; the sends at the end of the control loop
+ * go ahead
+ */
+static void handle_pace_timeout(context_t *ctx)
+{
+    if (ctx->pace_expire && current_time_us() >= ctx->pace_expire)
+        ctx->pace_expire = 0;
+}
+
+/* run the persist timer while data is waiting, nothing is in flight to
+ * draw out an ACK, and the peer's window is closed (RFC 9293 3.8.6.1);
+ * stop it, and forget the backoff, once the window opens or data is sent
+ */
+static void update_persist_timer(context_t *ctx)
+{
+    if (ctx->pending_len && !ctx->retx_queue.head && !ctx->their_recv_win){
+        if (!ctx->persist_expire)
+            ctx->persist_expire = current_time_us() + persist_timeout(ctx);
+        return;
+    }
+    ctx->persist_expire = 0;
+    ctx->persist_backoff = 0;
+}
+
+/* the interval before the next window probe: the RTO, doubled for every
+ * probe already sent, within [RTO_MIN, RTO_MAX]
+ */
+static uint64_t persist_timeout(context_t *ctx)
+{
+    uint64_t timeout = (uint64_t)ctx->rto << ctx->persist_backoff;
+
+    return std::min((uint64_t)RTO_MAX, std::max((uint64_t)RTO_MIN, timeout));
+}
+
+/* the persist timer fired: probe the closed window.  the probe is empty
+ * and carries snd_una - 1, a sequence number the peer has already seen, so
+ * it uses no sequence space and the peer answers it at once with an ACK
+ * giving its current window
+ */
+static void handle_persist_timeout(mysocket_t sd, context_t *ctx)
+{
+    uint64_t now = current_time_us();
+
+    if (!ctx->persist_expire || now < ctx->persist_expire)
+        return;
+
+    if (send_segment(sd, ctx, ctx->last_byte_ack, TH_ACK, 0) == -1){
+        dprintf("Error: stcp_network_send()");
+    }
+    if (ctx->persist_backoff < PERSIST_MAX_BACKOFF)
+        ctx->persist_backoff++;
+    ctx->persist_expire = now + persist_timeout(ctx);
+}
+
+/* a D-SACK says the peer received something twice.  if it covers our
+ * tail loss probe, the probe was not needed; if, one by one, D-SACKs cover
+ * every retransmission since the last window reduction, nothing was lost
+ * and the reduction is undone (RFC 3708)
+ */
+static void handle_dsack(context_t *ctx, tcp_seq ack,
+                         const sack_block_t *blocks, int num_blocks)
+{
+    const sack_block_t *dsack = &blocks[0];
+
+    //RFC 2883: the first block is a D-SACK if it lies below the cumulative
+    //ACK or inside the second block
+    if (!SEQ_LT(dsack->left, dsack->right))
+        return;
+    if (!SEQ_LEQ(dsack->right, ack) &&
+        !(num_blocks > 1 && SEQ_GEQ(dsack->left, blocks[1].left) &&
+          SEQ_LEQ(dsack->right, blocks[1].right)))
+        return;
+
+    if (ctx->tlp_outstanding && ctx->tlp_retransmitted &&
+        SEQ_LT(dsack->left, ctx->tlp_high_seq) &&
+        SEQ_GEQ(dsack->right, ctx->tlp_high_seq))
+        ctx->tlp_retransmitted = false;
+
+    if (!ctx->undo_possible || ctx->undo_retrans <= 0 ||
+        SEQ_LT(dsack->left, ctx->undo_marker))
+        return;
+    if (--ctx->undo_retrans == 0){
+        ctx->cc.ops->undo(&ctx->cc, &ctx->prior_cc);
+        ctx->undo_possible = false;
+    }
+}
+
+/* remember the congestion state before cutting the window, in case the
+ * cut turns out to be spurious
+ */
+static void save_undo_state(context_t *ctx)
+{
+    ctx->prior_cc = ctx->cc;
+    ctx->undo_possible = true;
+    ctx->undo_marker = ctx->last_byte_ack + 1;
+    ctx->undo_retrans = 0;
+}
+
+/* count a retransmission against the current undo episode */
+static void note_retransmission(context_t *ctx)
+{
+    if (ctx->undo_possible)
+        ctx->undo_retrans++;
+}
+
+/* put a segment on the list to be resent */
+static void mark_lost(context_t *ctx, retx_segment_t *seg)
+{
+    seg->lost = true;
+    ctx->lost_bytes += seg->seq_len;
+}
+
+/* a loss was detected without a timeout: cut the congestion window once
+ * per window of data, and repair losses until recovery_point is acked
+ */
+static void enter_recovery(context_t *ctx)
+{
+    if (ctx->in_recovery)
+        return;
+    ctx->in_recovery = true;
+    ctx->recovery_point = ctx->curr_sequence_num;
+    save_undo_state(ctx);
+    ctx->cc.ops->on_loss(&ctx->cc, current_time_us(),
+                         ctx->last_byte_sent - ctx->last_byte_ack);
+}
+
+/* resend segments presumed lost, oldest first, while the congestion window
+ * has room for them
+ */
+static void retransmit_lost_segments(mysocket_t sd, context_t *ctx)
+{
+    uint64_t now;
+
+    if (!ctx->lost_bytes)
+        return;
+    now = current_time_us();
+
+    for (retx_segment_t *seg = ctx->retx_queue.head;
+         seg && ctx->lost_bytes; seg = seg->next){
+        if (!seg->lost)
+            continue;
+        if (pipe_bytes(ctx) + seg->seq_len > ctx->cc.congestion_win ||
+            !pacing_allows(ctx, now))
+            break;
+
+        if (send_segment(sd, ctx, seg->seq, seg->flags,
+                         seg->data_len) == -1){
+            dprintf("Error: stcp_network_send()");
+            break;
+        }
+        seg->lost = false;
+        ctx->lost_bytes -= seg->seq_len;
+        seg->retransmitted = true;
+        note_retransmission(ctx);
+        stamp_segment(ctx, seg, now);
+    }
+}
+
+/* hold a segment that arrived ahead of recv_next_seq, so that it can be
+ * SACKed and later handed to the app without being resent.  returns FALSE
+ * if all of it was already held.
+ */
+static bool_t queue_out_of_order(context_t *ctx, tcp_seq seq,
+                                 const char *data, size_t len)
+{
+    tcp_seq edge = ctx->recv_adv_set ? ctx->recv_adv
+                                     : ctx->recv_next_seq + std::min(ctx->recv_win, (tcp_seq)0xffff);
+
+    //Never hold more than we advertised room for
+    if (SEQ_GT(seq + len, edge))
+        return true;
+    return reasm_insert(&ctx->reasm, seq, data, len);
+}
+
+/* the peer sent us data we already had: report it as a D-SACK block on the
+ * next ACK (RFC 2883), so the peer can tell its retransmission was spurious
+ */
+static void report_duplicate(context_t *ctx, tcp_seq left, tcp_seq right)
+{
+    ctx->dsack.left = left;
+    ctx->dsack.right = right;
+    ctx->dsack_pending = true;
+}
+
+/* hand the app any held data that is now in sequence */
+static void deliver_out_of_order(mysocket_t sd, context_t *ctx)
+{
+    const reasm_interval_t *iv;
+
+    while ((iv = ctx->reasm.head) && SEQ_LEQ(iv->seq, ctx->recv_next_seq)){
+        tcp_seq end = iv->seq + iv->len;
+
+        if (SEQ_GT(end, ctx->recv_next_seq)){
+            size_t skip = ctx->recv_next_seq - iv->seq;
+            stcp_app_send(sd, iv->data + skip, iv->len - skip);
+            ctx->recv_next_seq = end;
+        }
+        reasm_pop(&ctx->reasm);
+    }
+}
+
+/* describe the held out-of-order data as SACK blocks, the block holding the
+ * most recent arrival first (RFC 2018); returns the number of blocks
+ */
+static int build_sack_blocks(context_t *ctx, sack_block_t *blocks, int max_blocks)
+{
+    const reasm_interval_t *recent = reasm_recent(&ctx->reasm);
+    int num_blocks = 0;
+
+    //A D-SACK always goes first, and only once
+    if (ctx->dsack_pending && num_blocks < max_blocks){
+        blocks[num_blocks++] = ctx->dsack;
+        ctx->dsack_pending = false;
+    }
+
+    if (recent && num_blocks < max_blocks){
+        blocks[num_blocks].left = recent->seq;
+        blocks[num_blocks].right = recent->seq + recent->len;
+        num_blocks++;
+    }
+    for (const reasm_interval_t *iv = ctx->reasm.head;
+         iv && num_blocks < max_blocks; iv = iv->next){
+        if (iv == recent)
+            continue;
+        blocks[num_blocks].left = iv->seq;
+        blocks[num_blocks].right = iv->seq + iv->len;
+        num_blocks++;
+    }
+    return num_blocks;
+}
+
+/* an in-order segment arrived: acknowledge it now if enough are waiting,
+ * otherwise make sure the delayed ACK timer is running
+ */
+static void schedule_ack(mysocket_t sd, context_t *ctx, uint64_t now)
+{
+    if (ctx->ack_mode == MYSOCK_ACK_ADAPTIVE){
+        //Once per timer period, allow roughly four ACKs per period's worth
+        //of arrivals; a slow sender sees an ACK every second segment
+        if (now - ctx->rate_stamp >= DELACK_TIMEOUT){
+            ctx->ack_every = std::max(ACK_EVERY,
+                                      std::min(ACK_EVERY_MAX, ctx->rate_segs / 4));
+            ctx->rate_stamp = now;
+            ctx->rate_segs = 0;
+        }
+        ctx->rate_segs++;
+    }
+
+    if (ctx->ack_mode == MYSOCK_ACK_IMMEDIATE ||
+        ++ctx->segs_unacked >= ctx->ack_every){
+        send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
+        return;
+    }
+    if (!ctx->delack_expire)
+        ctx->delack_expire = now + DELACK_TIMEOUT;
+}
+
+/* the delayed ACK timer fired: acknowledge whatever is waiting */
+static void handle_delack_timeout(mysocket_t sd, context_t *ctx)
+{
+    if (!ctx->delack_expire || current_time_us() < ctx->delack_expire)
+        return;
+
+    //The sender ran out of window before we saw ack_every segments, so we
+    //are thinning too hard for it
+    ctx->ack_every = ACK_EVERY;
+    send_segment(sd, ctx, ctx->curr_sequence_num, TH_ACK, 0);
+}
+
+/* fold a round-trip time sample (usec) into SRTT/RTTVAR and recompute the
+ * retransmission timeout, as in RFC 6298
+ */
+static void update_rtt(context_t *ctx, uint32_t rtt)
+{
+    if (!ctx->srtt){
+        ctx->srtt = std::max(rtt, (uint32_t)1);
+        ctx->rttvar = rtt / 2;
+    }
+    else{
+        uint32_t delta = (rtt > ctx->srtt) ? rtt - ctx->srtt : ctx->srtt - rtt;
+        //RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+        ctx->rttvar = ctx->rttvar - ctx->rttvar / 4 + delta / 4;
+        ctx->srtt = ctx->srtt - ctx->srtt / 8 + rtt / 8;
+    }
+
+    ctx->rto = ctx->srtt + std::max((uint32_t)CLOCK_GRANULARITY, 4 * ctx->rttvar);
+    ctx->rto = std::min((uint32_t)RTO_MAX, std::max((uint32_t)RTO_MIN, ctx->rto));
+}
+
+/* write the options for an outgoing segment into opts, padded to a
+ * multiple of four bytes; returns their length.  room is the space the
+ * segment's payload leaves in the datagram; SACK blocks are left out if
+ * they don't fit in it
+ */
+static size_t build_options(context_t *ctx, uint8_t flags, uint8_t *opts,
+                            size_t room)
+{
+    size_t len = 0;
+    int max_blocks;
+
+    //Tell the peer how large a segment we can receive
+    if (flags & TH_SYN){
+        uint16_t mss = htons((uint16_t)ctx->rcv_mss);
+
+        opts[len++] = TCPOPT_MAXSEG;
+        opts[len++] = TCPOLEN_MAXSEG;
+        memcpy(opts + len, &mss, sizeof(mss));
+        len += sizeof(mss);
+    }
+
+    //Offer window scaling in our SYN; only echo it if the peer offered too
+    if ((flags & TH_SYN) && (!(flags & TH_ACK) || ctx->wscale_ok)){
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_WINDOW;
+        opts[len++] = TCPOLEN_WINDOW;
+        opts[len++] = ctx->rcv_wscale;
+    }
+    //Likewise for SACK
+    if ((flags & TH_SYN) && (!(flags & TH_ACK) || ctx->sack_ok)){
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_SACK_PERMITTED;
+        opts[len++] = TCPOLEN_SACK_PERMITTED;
+    }
+    //and timestamps, which once agreed go on every segment
+    if (((flags & TH_SYN) && !(flags & TH_ACK)) || ctx->ts_ok){
+        uint32_t stamps[2] = { htonl(ts_now()),
+                               htonl((flags & TH_ACK) ? ctx->ts_recent : 0) };
+
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_TIMESTAMP;
+        opts[len++] = TCPOLEN_TIMESTAMP;
+        memcpy(opts + len, stamps, sizeof(stamps));
+        len += sizeof(stamps);
+    }
+
+    //Report held out-of-order data on every ACK that has room for it
+    room = std::min(room, (size_t)TCP_MAX_OPTIONS_LEN);
+    max_blocks = (room >= len + 4) ? (room - len - 4) / TCPOLEN_SACK_BLOCK : 0;
+    if (!(flags & TH_SYN) && (flags & TH_ACK) && ctx->sack_ok && max_blocks > 0 &&
+        (ctx->reasm.head || ctx->dsack_pending)){
+        sack_block_t blocks[TCP_MAX_SACK_BLOCKS];
+        int num_blocks = build_sack_blocks(ctx, blocks,
+                                           std::min(max_blocks, TCP_MAX_SACK_BLOCKS));
+
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_NOP;
+        opts[len++] = TCPOPT_SACK;
+        opts[len++] = 2 + num_blocks * TCPOLEN_SACK_BLOCK;
+        for (int i = 0; i < num_blocks; i++){
+            uint32_t edges[2] = { htonl(blocks[i].left), htonl(blocks[i].right) };
+            memcpy(opts + len, edges, sizeof(edges));
+            len += sizeof(edges);
+        }
+    }
+
+    assert(len % sizeof(uint32_t) == 0 && len <= TCP_MAX_OPTIONS_LEN);
+    return len;
+}
+
+/* locate an option of the given kind in a received header; returns NULL
+ * if it is absent or the options area is malformed
+ */
+static const uint8_t *find_option(const tcphdr *hdr, size_t len, uint8_t kind)
+{
+    const uint8_t *opt = (const uint8_t *)(hdr + 1);
+    const uint8_t *end;
+
+    if (TCP_DATA_START(hdr) < sizeof(tcphdr) || TCP_DATA_START(hdr) > len)
+        return NULL;
+    end = opt + TCP_OPTIONS_LEN(hdr);
+
+    while (opt < end && *opt != TCPOPT_EOL){
+        if (*opt == TCPOPT_NOP){
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+            return NULL;
+        if (opt[0] == kind)
+            return opt;
+        opt += opt[1];
+    }
+    return NULL;
+}
+
+/* pick up the options the peer sent in its SYN or SYN-ACK */
+static void parse_syn_options(context_t *ctx, const tcphdr *hdr, size_t len)
+{
+    const uint8_t *opt;
+    uint32_t tsecr;
+    uint32_t peer_mss = STCP_MSS;
+
+    //Scaling is only used if both sides asked for it
+    opt = find_option(hdr, len, TCPOPT_WINDOW);
+    ctx->wscale_ok = (opt && opt[1] == TCPOLEN_WINDOW);
+    if (ctx->wscale_ok)
+        ctx->snd_wscale = std::min(opt[2], (uint8_t)TCP_MAX_WINSHIFT);
+    else{
+        ctx->snd_wscale = 0;
+        ctx->rcv_wscale = 0;
+    }
+
+    opt = find_option(hdr, len, TCPOPT_SACK_PERMITTED);
+    ctx->sack_ok = (opt && opt[1] == TCPOLEN_SACK_PERMITTED);
+
+    //Echo the peer's first timestamp in our SYN-ACK or ACK
+    ctx->ts_ok = parse_timestamp_option(hdr, len, &ctx->ts_recent, &tsecr);
+    ctx->ts_recent_time = current_time_us();
+
+    //Segments are as large as both ends and the network allow; the MSS
+    //counts no options (RFC 6691), so the timestamps every segment carries
+    //come out of it
+    opt = find_option(hdr, len, TCPOPT_MAXSEG);
+    if (opt && opt[1] == TCPOLEN_MAXSEG){
+        uint16_t mss;
+
+        memcpy(&mss, opt + 2, sizeof(mss));
+        peer_mss = std::max(ntohs(mss), (uint16_t)TCP_MIN_MSS);
+    }
+    ctx->max_packet = std::min(ctx->rcv_mss, peer_mss) + sizeof(tcphdr);
+    ctx->mss = ctx->max_packet - sizeof(tcphdr) -
+               (ctx->ts_ok ? 2 + TCPOLEN_TIMESTAMP : 0);
+}
+
+/* read the timestamp option, if the segment carries one */
+static bool_t parse_timestamp_option(const tcphdr *hdr, size_t len,
+                                     uint32_t *tsval, uint32_t *tsecr)
+{
+    const uint8_t *opt = find_option(hdr, len, TCPOPT_TIMESTAMP);
+    uint32_t stamps[2];
+
+    if (!opt || opt[1] != TCPOLEN_TIMESTAMP)
+        return false;
+    memcpy(stamps, opt + 2, sizeof(stamps));
+    *tsval = ntohl(stamps[0]);
+    *tsecr = ntohl(stamps[1]);
+    return true;
+}
+
+/* apply PAWS (RFC 7323 5.3) to an arriving segment and pick up its
+ * timestamps.  returns false if the segment is an old duplicate; if not,
+ * tsecr is set to the timestamp it echoes (0 if none).  the peer's TSval
+ * is only kept from segments that start at or before the last ACK we
+ * sent, so that what we echo covers the time our ACKs were delayed
+ */
+static bool_t check_timestamps(context_t *ctx, const tcphdr *hdr, size_t len,
+                               uint32_t *tsecr)
+{
+    uint64_t now = current_time_us();
+    uint32_t tsval;
+
+    //Accepted, though the peer should have stamped it
+    if (!parse_timestamp_option(hdr, len, &tsval, tsecr)){
+        *tsecr = 0;
+        return true;
+    }
+    if (!(hdr->th_flags & TH_ACK))
+        *tsecr = 0;
+
+    if (SEQ_LT(tsval, ctx->ts_recent) && now - ctx->ts_recent_time < PAWS_IDLE)
+        return false;
+    if (SEQ_LEQ(ntohl(hdr->th_seq), ctx->last_ack_num_sent)){
+        ctx->ts_recent = tsval;
+        ctx->ts_recent_time = now;
+    }
+    return true;
+}
+
+/* our timestamp clock: TS_TICK_US ticks on the timer wheel's clock */
+static uint32_t ts_now(void)
+{
+    return (uint32_t)(current_time_us() / TS_TICK_US);
+}
+
+/* read the blocks of a SACK option, if the segment carries one; returns
+ * the number of blocks
+ */
+static int parse_sack_option(const tcphdr *hdr, size_t len, sack_block_t *blocks)
+{
+    const uint8_t *opt = find_option(hdr, len, TCPOPT_SACK);
+    int num_blocks;
+
+    if (!opt || (opt[1] - 2) % TCPOLEN_SACK_BLOCK)
+        return 0;
+    num_blocks = std::min((opt[1] - 2) / TCPOLEN_SACK_BLOCK, TCP_MAX_SACK_BLOCKS);
+    for (int i = 0; i < num_blocks; i++){
+        uint32_t edges[2];
+        memcpy(edges, opt + 2 + i * TCPOLEN_SACK_BLOCK, sizeof(edges));
+        blocks[i].left = ntohl(edges[0]);
+        blocks[i].right = ntohl(edges[1]);
+    }
+    return num_blocks;
+}
+
+/* the value to put in th_win: unscaled in SYNs, scaled afterwards.
+ * recv_adv is left at the right edge this value tells the peer about
+ */
+static uint16_t advertised_window(mysocket_t sd, context_t *ctx, uint8_t flags)
+{
+    tcp_seq edge;
+    tcp_seq win;
+    bool_t moved = false;
+
+    if (flags & TH_SYN)
+        return (uint16_t)std::min(ctx->recv_win, (tcp_seq)0xffff);
+    edge = ctx->recv_next_seq + receive_space(sd, ctx);
+
+    //Receiver-side SWS avoidance (RFC 9293 3.8.6.2.2): only move the right
+    //edge in steps of an MSS or half the buffer, and never move it back.
+    //a tail loss probe may have overrun it, though
+    if (!ctx->recv_adv_set || SEQ_LT(ctx->recv_adv, ctx->recv_next_seq) ||
+        SEQ_GEQ(edge, ctx->recv_adv + std::min(ctx->recv_win / 2, (tcp_seq)ctx->mss))){
+        ctx->recv_adv = edge;
+        ctx->recv_adv_set = true;
+        moved = true;
+    }
+
+    //Scaling drops the low bits of the window.  a new edge is rounded
+    //down to what th_win can say; an old one is rounded up, as Linux
+    //does, so that it doesn't move back
+    win = ctx->recv_adv - ctx->recv_next_seq;
+    if (!moved)
+        win += (1 << ctx->rcv_wscale) - 1;
+    win = std::min(win >> ctx->rcv_wscale, (tcp_seq)0xffff);
+    ctx->recv_adv = ctx->recv_next_seq + (win << ctx->rcv_wscale);
+    return (uint16_t)win;
+}
+
+/* free space in the receive buffer: what the app has not read yet and the
+ * out-of-order data we hold both count against it
+ */
+static tcp_seq receive_space(mysocket_t sd, context_t *ctx)
+{
+    size_t used = stcp_app_unread(sd) + ctx->reasm.bytes;
+
+    return (used < ctx->recv_win) ? ctx->recv_win - used : 0;
+}
+
+/* the app has read data while the window we offered was small: send a
+ * window update once the right edge can move by the SWS step and the
+ * window has at least doubled, or reached half the buffer
+ */
+static bool_t window_update_due(mysocket_t sd, context_t *ctx)
+{
+    tcp_seq space = receive_space(sd, ctx);
+    tcp_seq offered;
+
+    if (!ctx->recv_adv_set || ctx->fin_recv)
+        return false;
+    offered = SEQ_GT(ctx->recv_adv, ctx->recv_next_seq)
+            ? ctx->recv_adv - ctx->recv_next_seq : 0;
+    return SEQ_GEQ(ctx->recv_next_seq + space,
+                   ctx->recv_adv + std::min(ctx->recv_win / 2, (tcp_seq)ctx->mss)) &&
+           space >= std::min(2 * offered, ctx->recv_win / 2);
+}
+
+/* receive buffer auto-tuning (dynamic right-sizing, as in Linux).  the
+ * time the peer takes to fill the window we offered bounds the RTT from
+ * above; once per RTT the buffer is grown to twice what arrived in the
+ * last one, so the window stays ahead of a sender that is still speeding
+ * up, and a sender held back by a slow app grows nothing
+ */
+static void tune_recv_buffer(context_t *ctx, uint64_t now)
+{
+    uint32_t rtt;
+    tcp_seq copied;
+
+    if (!ctx->rcv_rtt_time){
+        ctx->rcv_rtt_time = now;
+        ctx->rcv_rtt_seq = ctx->recv_adv_set ? ctx->recv_adv
+                                             : ctx->recv_next_seq + ctx->recv_win;
+    }
+    else if (SEQ_GEQ(ctx->recv_next_seq, ctx->rcv_rtt_seq)){
+        uint32_t sample = std::max((uint32_t)(now - ctx->rcv_rtt_time), (uint32_t)1);
+
+        if (!ctx->rcv_rtt || sample < ctx->rcv_rtt)
+            ctx->rcv_rtt = sample;
+        ctx->rcv_rtt_time = 0;
+    }
+
+    //Data we send gives a better estimate, if there has been any
+    rtt = ctx->rcv_rtt;
+    if (ctx->srtt && (!rtt || ctx->srtt < rtt))
+        rtt = ctx->srtt;
+
+    if (!ctx->rcvq_time){
+        ctx->rcvq_time = now;
+        ctx->rcvq_seq = ctx->recv_next_seq;
+        return;
+    }
+    if (!rtt || now - ctx->rcvq_time < rtt)
+        return;
+
+    copied = ctx->recv_next_seq - ctx->rcvq_seq;
+    if (copied > ctx->recv_win / 2)
+        ctx->recv_win = std::min((tcp_seq)RECV_WIN_MAX, 2 * copied);
+    ctx->rcvq_time = now;
+    ctx->rcvq_seq = ctx->recv_next_seq;
+}
+
+/* a blank segment for the retransmission queue.  acknowledged segments
+ * are recycled, so once the window has been full the data path no longer
+ * allocates.
+ */
+static retx_segment_t *alloc_segment(context_t *ctx)
+{
+    retx_segment_t *seg = ctx->free_segs;
+
+    if (seg)
+        ctx->free_segs = seg->next;
+    else{
+        seg = (retx_segment_t *)malloc(sizeof(retx_segment_t));
+        assert(seg);
+    }
+
+    memset(seg, 0, sizeof(*seg));
+    return seg;
+}
+
+static void release_segment(context_t *ctx, retx_segment_t *seg)
+{
+    seg->next = ctx->free_segs;
+    ctx->free_segs = seg;
+}
+
+static void free_segment_list(retx_segment_t *seg)
+{
+    while (seg){
+        retx_segment_t *next = seg->next;
+        free(seg);
+        seg = next;
+    }
+}
+
 /**********************************************************************/
 /* dprintf
  *
  * Send a formatted message to stdout.
- * 
+ *
  * format               A printf-style format string.
  *
  * This function is equivalent to a printf, but may be
@@ -519,6 +2054,3 @@ void our_dprintf(const char *format,...)
     fputs(buffer, stdout);
     fflush(stdout);
 }
-
-
-
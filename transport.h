@@ -67,13 +67,41 @@ typedef struct tcphdr
 } __attribute__ ((packed)) STCPHeader;
 
 
+/* sequence number comparisons that survive wrap-around */
+#define SEQ_LT(a,b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a,b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a,b)  ((int32_t)((a) - (b)) > 0)
+#define SEQ_GEQ(a,b) ((int32_t)((a) - (b)) >= 0)
+
 /* starting byte position of data in TCP packet p */
 #define TCP_DATA_START(p) (((STCPHeader *) p)->th_off * sizeof(uint32_t))
 
 /* length of options (in bytes) in TCP packet p */
 #define TCP_OPTIONS_LEN(p) (TCP_DATA_START(p) - sizeof(struct tcphdr))
 
-/* STCP maximum segment size */
+/* largest options area a header can describe (th_off is 4 bits) */
+#define TCP_MAX_OPTIONS_LEN 40
+
+/* TCP option kinds and lengths */
+#define TCPOPT_EOL          0
+#define TCPOPT_NOP          1
+#define TCPOPT_MAXSEG       2   /* maximum segment size (RFC 9293, 6691) */
+#define TCPOLEN_MAXSEG      4
+#define TCP_MIN_MSS         88  /* smallest MSS we take from a peer */
+#define TCPOPT_WINDOW       3   /* window scale (RFC 7323) */
+#define TCPOLEN_WINDOW      3
+#define TCPOPT_SACK_PERMITTED 4 /* selective acknowledgements (RFC 2018) */
+#define TCPOLEN_SACK_PERMITTED 2
+#define TCPOPT_SACK         5
+#define TCPOLEN_SACK_BLOCK  8   /* per block, after the kind and length */
+#define TCP_MAX_SACK_BLOCKS 4
+#define TCPOPT_TIMESTAMP    8   /* timestamps (RFC 7323) */
+#define TCPOLEN_TIMESTAMP   10
+#define TCP_MAX_WINSHIFT    14
+
+/* maximum segment size assumed for a peer that sends no MSS option; the
+ * connection's own is negotiated in the handshake
+ */
 #define STCP_MSS 536
 
 